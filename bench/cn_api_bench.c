@@ -0,0 +1,564 @@
+/*
+ * cn_api_bench, measures the cost of the public functions of the API
+ *
+ * The API needs a terminal, so the benchmark makes its own: a pseudo
+ * terminal whose slave side becomes stdin and stdout, while a thread reads
+ * everything written to the master side, like a terminal emulator would.
+ * It runs the same way on a desktop, over SSH, or on a headless box.
+ *
+ * The system calls made by the API are counted by wrapping them at link
+ * time(-Wl,--wrap=write and so on, see CMakeLists.txt), the bytes it emits
+ * are the bytes it writes to stdout.
+ *
+ * For each scenario, one line is printed:
+ *   name, iterations, ns/op, syscalls/op, bytes/op
+ * Usage: cn_api_bench [filter], only the scenarios whose name contains
+ * filter are run
+ *
+ * Keys are decoded from the terminal(CONSOLE_API_INPUT=tty), unless
+ * CONSOLE_API_INPUT is set, the keys of the menu scenarios are typed
+ * through the pseudo terminal with the kitty keyboard protocol, so
+ * they are skipped with any other key backend.
+ */
+#define _GNU_SOURCE
+#include "console_api.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Minimum time each scenario runs for, in nanos */
+#define BENCH_MIN_NS (200000000LL)
+
+/* Size of the pseudo terminal */
+#define BENCH_COLS (80)
+#define BENCH_ROWS (24)
+
+/* System call counters, see the wrappers below */
+static unsigned long long s_bench_syscalls;
+static unsigned long long s_bench_bytes;
+static pthread_t s_bench_main;
+
+/* Only the calls of the thread that runs the API are counted */
+#define BENCH_COUNT() \
+    (pthread_equal(pthread_self(), s_bench_main) ? ++s_bench_syscalls : 0)
+
+ssize_t __real_write(int fd, void const *buf, size_t count);
+ssize_t __real_read(int fd, void *buf, size_t count);
+int __real_ioctl(int fd, unsigned long req, ...);
+int __real_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+int __real_epoll_wait(int epfd, struct epoll_event *evs, int max, int timeout);
+int __real_tcgetattr(int fd, struct termios *t);
+int __real_tcsetattr(int fd, int act, struct termios const *t);
+int __real_tcflush(int fd, int queue);
+
+ssize_t __wrap_write(int fd, void const *buf, size_t count)
+{
+    ssize_t written = __real_write(fd, buf, count);
+    BENCH_COUNT();
+    if(fd == STDOUT_FILENO && written > 0)
+        s_bench_bytes += written;
+    return written;
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+    BENCH_COUNT();
+    return __real_read(fd, buf, count);
+}
+
+int __wrap_ioctl(int fd, unsigned long req, ...)
+{
+    va_list args;
+    va_start(args, req);
+    void *arg = va_arg(args, void *);
+    va_end(args);
+
+    BENCH_COUNT();
+    return __real_ioctl(fd, req, arg);
+}
+
+int __wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    BENCH_COUNT();
+    return __real_poll(fds, nfds, timeout);
+}
+
+int __wrap_epoll_wait(int epfd, struct epoll_event *evs, int max, int timeout)
+{
+    BENCH_COUNT();
+    return __real_epoll_wait(epfd, evs, max, timeout);
+}
+
+int __wrap_tcgetattr(int fd, struct termios *t)
+{
+    BENCH_COUNT();
+    return __real_tcgetattr(fd, t);
+}
+
+int __wrap_tcsetattr(int fd, int act, struct termios const *t)
+{
+    BENCH_COUNT();
+    return __real_tcsetattr(fd, act, t);
+}
+
+int __wrap_tcflush(int fd, int queue)
+{
+    BENCH_COUNT();
+    return __real_tcflush(fd, queue);
+}
+
+static long long s_bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Pseudo terminal */
+static int s_bench_master = -1;
+static FILE *s_bench_out; /* The real stdout, for the results */
+static pthread_t s_bench_drain_thread;
+static int s_bench_answer = 1; /* 1 while the terminal queries are answered */
+
+/* Writes all of data to the master side, as if it was typed */
+static void s_bench_type(char const *data, size_t len)
+{
+    while(len)
+    {
+        ssize_t written = __real_write(s_bench_master, data, len);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+/*
+ * Reads all the output of the API, so that it never blocks on a full
+ * terminal, and answers the queries of console_init: the terminal
+ * supports the kitty keyboard protocol(\e[?u) and is a VT220(\e[c)
+ */
+static void *s_bench_drain(void *arg)
+{
+    (void) arg;
+    char buf[65536];
+    while(1)
+    {
+        ssize_t rd = __real_read(s_bench_master, buf, sizeof(buf));
+        if(rd < 0 && errno == EINTR)
+            continue;
+        if(rd <= 0)
+            break;
+
+        if(!__atomic_load_n(&s_bench_answer, __ATOMIC_ACQUIRE))
+            continue;
+        if(memmem(buf, rd, "\033[?u", 4))
+            s_bench_type("\033[?0u", 5);
+        if(memmem(buf, rd, "\033[c", 3))
+            s_bench_type("\033[?62;c", 7);
+    }
+    return 0;
+}
+
+/* Makes a pseudo terminal the stdin and stdout of the program */
+static int s_bench_pty_open()
+{
+    s_bench_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(
+       s_bench_master < 0
+    || grantpt(s_bench_master) < 0
+    || unlockpt(s_bench_master) < 0
+    )
+        return -1;
+
+    int slave = open(ptsname(s_bench_master), O_RDWR | O_NOCTTY);
+    if(slave < 0)
+        return -1;
+
+    struct winsize ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_col = BENCH_COLS;
+    ws.ws_row = BENCH_ROWS;
+    __real_ioctl(slave, TIOCSWINSZ, &ws);
+
+    int out = dup(STDOUT_FILENO);
+    if(out < 0)
+        return -1;
+    s_bench_out = fdopen(out, "w");
+    if(!s_bench_out)
+        return -1;
+
+    if(dup2(slave, STDIN_FILENO) < 0 || dup2(slave, STDOUT_FILENO) < 0)
+        return -1;
+    close(slave);
+
+    return pthread_create(&s_bench_drain_thread, 0, s_bench_drain, 0)
+         ? -1
+         : 0;
+}
+
+/* Scenarios */
+struct BENCH;
+typedef struct BENCH bench;
+struct BENCH
+{
+    char const *name;
+    void (*setup)();
+    void (*op)(); /* One operation, run as many times as needed */
+    void (*teardown)();
+    int tty_keys; /* 1 if it needs the keys typed through the pty */
+};
+
+static void s_bench_key_state()
+{
+    console_key_state(CONSOLE_KEY_UP);
+}
+
+static void s_bench_event_mode()
+{
+    console_key_mode(CONSOLE_KEY_MODE_EVENT);
+}
+
+static void s_bench_query_mode()
+{
+    console_key_mode(CONSOLE_KEY_MODE_QUERY);
+}
+
+/* What a game does each frame in event mode: one update, then a few keys */
+static void s_bench_key_frame()
+{
+    console_key_update();
+    console_key_state(CONSOLE_KEY_UP);
+    console_key_state(CONSOLE_KEY_DOWN);
+    console_key_state(CONSOLE_KEY_LEFT);
+    console_key_state(CONSOLE_KEY_RIGHT);
+    console_key_state(CONSOLE_KEY_ENTER);
+    console_key_state(CONSOLE_KEY_SPACE);
+    console_key_state(CONSOLE_KEY_ESCAPE);
+    console_key_state(CONSOLE_KEY_ALNUM(Q));
+}
+
+static void s_bench_key_snapshot()
+{
+    console_keymap state, pressed, released;
+    console_key_snapshot(&state, &pressed, &released);
+}
+
+static int s_bench_counter;
+
+static void s_bench_style_calls()
+{
+    int c = s_bench_counter++ & 0xFF;
+    console_bold(1);
+    console_color_foreground(c, 255 - c, 128);
+    console_color_background(0, 0, c);
+    console_write("x", 1);
+    console_style_reset();
+}
+
+static void s_bench_style_set()
+{
+    static console_style const styles[2] =
+    {
+        CONSOLE_STYLE_FG(255, 0, 0, CONSOLE_ATTR_BOLD),
+        CONSOLE_STYLE_FG_BG(0, 255, 0, 0, 0, 64, CONSOLE_ATTR_UNDERLINE)
+    };
+    console_style_set(&styles[s_bench_counter++ & 1]);
+    console_write("x", 1);
+}
+
+static void s_bench_write_flush()
+{
+    static char const line[64] =
+        "The quick brown fox jumps over the lazy dog, again and again...";
+    console_write(line, sizeof(line));
+    console_flush();
+}
+
+static void s_bench_clear()
+{
+    console_clear();
+    console_flush();
+}
+
+static void s_bench_title()
+{
+    console_title("cn_api_bench");
+    console_flush();
+}
+
+/* A whole text frame, 24 colored lines, written and flushed */
+static void s_bench_text_frame()
+{
+    static char const line[] =
+        "Score 000000   Lives 3   Level 01   ........................";
+    console_clear();
+    for(int i = 0; i < BENCH_ROWS - 1; ++i)
+    {
+        console_color_foreground(i * 10, 255 - i * 10, 128);
+        console_write(line, sizeof(line) - 1);
+        console_write("\n", 1);
+    }
+    console_style_reset();
+    console_flush();
+}
+
+static void s_bench_screen_setup()
+{
+    console_screen_init(0, 0);
+    console_screen_clear();
+    console_screen_present();
+}
+
+static void s_bench_screen_teardown()
+{
+    console_screen_free();
+}
+
+static void s_bench_screen_same()
+{
+    console_screen_present();
+}
+
+static void s_bench_screen_cell()
+{
+    console_screen_put(40, 12, 'a' + (s_bench_counter++ & 15), 0);
+    console_screen_present();
+}
+
+static void s_bench_screen_full()
+{
+    static console_style const style =
+        CONSOLE_STYLE_FG(200, 200, 0, CONSOLE_ATTR_BOLD);
+    int flip = s_bench_counter++ & 1;
+    for(int y = 0; y < BENCH_ROWS; ++y)
+        for(int x = 0; x < BENCH_COLS; ++x)
+            console_screen_put(x, y, flip ? '#' : '.', flip ? &style : 0);
+    console_screen_present();
+}
+
+/* Menu: the whole menu is one operation, its keys are typed by a thread */
+#define BENCH_MENU_KEYS (200)
+
+static menu_ent *s_bench_menu_ents;
+static size_t s_bench_menu_count;
+static char *s_bench_menu_text;
+
+/* What the typist thread types for one menu */
+static char s_bench_typed[8192];
+static size_t s_bench_typed_len;
+
+/* kitty keyboard protocol press and release of keys */
+#define BENCH_TAP_DOWN      "\033[B\033[1;1:3B"
+#define BENCH_TAP_ENTER     "\033[13u\033[13;1:3u"
+#define BENCH_TAP_BACKSPACE "\033[127u\033[127;1:3u"
+
+static void s_bench_typed_add(char const *keys)
+{
+    size_t len = strlen(keys);
+    memcpy(s_bench_typed + s_bench_typed_len, keys, len);
+    s_bench_typed_len += len;
+}
+
+static void *s_bench_menu_typist(void *arg)
+{
+    (void) arg;
+    s_bench_type(s_bench_typed, s_bench_typed_len);
+    return 0;
+}
+
+static void s_bench_menu_ents_make(size_t count)
+{
+    s_bench_menu_ents = calloc(count, sizeof(*s_bench_menu_ents));
+    s_bench_menu_text = malloc(count * 32);
+    s_bench_menu_count = count;
+    for(size_t i = 0; i < count; ++i)
+    {
+        char *name = s_bench_menu_text + i * 32;
+        snprintf(name, 32, "Entry %zu", i);
+        s_bench_menu_ents[i].ent_name = name;
+        s_bench_menu_ents[i].ent_detail = "detail";
+        s_bench_menu_ents[i].ent_val = i;
+    }
+    s_bench_typed_len = 0;
+}
+
+static void s_bench_menu_scroll_setup()
+{
+    s_bench_menu_ents_make(1000);
+    for(int i = 0; i < BENCH_MENU_KEYS; ++i)
+        s_bench_typed_add(BENCH_TAP_DOWN);
+    s_bench_typed_add(BENCH_TAP_ENTER);
+}
+
+static void s_bench_menu_filter_setup()
+{
+    s_bench_menu_ents_make(100000);
+
+    // Types "entry 9" and erases it, a few times
+    char const *text = "entry 9";
+    for(int i = 0; i < 4; ++i)
+    {
+        for(char const *c = text; *c; ++c)
+        {
+            char tap[32];
+            snprintf(tap, sizeof(tap), "\033[%du\033[%d;1:3u", *c, *c);
+            s_bench_typed_add(tap);
+        }
+        for(char const *c = text; *c; ++c)
+            s_bench_typed_add(BENCH_TAP_BACKSPACE);
+    }
+    s_bench_typed_add(BENCH_TAP_ENTER);
+}
+
+static void s_bench_menu_teardown()
+{
+    free(s_bench_menu_ents);
+    free(s_bench_menu_text);
+}
+
+static void s_bench_menu()
+{
+    pthread_t typist;
+    pthread_create(&typist, 0, s_bench_menu_typist, 0);
+    console_menu("Pick one", s_bench_menu_ents, s_bench_menu_count);
+    pthread_join(typist, 0);
+}
+
+static bench const s_benches[] =
+{
+    { "key_state(query)", 0, s_bench_key_state, 0, 0 },
+    {
+        "key_update+8 key_state(event)",
+        s_bench_event_mode, s_bench_key_frame, s_bench_query_mode, 0
+    },
+    { "key_snapshot", 0, s_bench_key_snapshot, 0, 0 },
+    { "style calls+write 1", 0, s_bench_style_calls, 0, 0 },
+    { "style_set+write 1", 0, s_bench_style_set, 0, 0 },
+    { "write 64+flush", 0, s_bench_write_flush, 0, 0 },
+    { "clear+flush", 0, s_bench_clear, 0, 0 },
+    { "title+flush", 0, s_bench_title, 0, 0 },
+    { "frame: 23 colored lines", 0, s_bench_text_frame, 0, 0 },
+    {
+        "frame: screen present, same",
+        s_bench_screen_setup, s_bench_screen_same, s_bench_screen_teardown, 0
+    },
+    {
+        "frame: screen present, 1 cell",
+        s_bench_screen_setup, s_bench_screen_cell, s_bench_screen_teardown, 0
+    },
+    {
+        "frame: screen present, all cells",
+        s_bench_screen_setup, s_bench_screen_full, s_bench_screen_teardown, 0
+    },
+    {
+        "menu: 1000 entries, 200 DOWN+ENTER",
+        s_bench_menu_scroll_setup, s_bench_menu, s_bench_menu_teardown, 1
+    },
+    {
+        "menu: 100000 entries, filter typing",
+        s_bench_menu_filter_setup, s_bench_menu, s_bench_menu_teardown, 1
+    },
+};
+
+static void s_bench_run(bench const *b)
+{
+    if(b->setup)
+        b->setup();
+
+    // The first run warms up caches and lazy allocations
+    b->op();
+
+    unsigned long long syscalls = s_bench_syscalls;
+    unsigned long long bytes = s_bench_bytes;
+    long long start = s_bench_now_ns();
+    long long elapsed = 0;
+    size_t iters = 0;
+
+    // Runs batches that double in size, until enough time passed
+    for(size_t batch = 1; elapsed < BENCH_MIN_NS; batch *= 2)
+    {
+        for(size_t i = 0; i < batch; ++i)
+            b->op();
+        iters += batch;
+        elapsed = s_bench_now_ns() - start;
+        if(b->tty_keys)
+            break;
+    }
+
+    syscalls = s_bench_syscalls - syscalls;
+    bytes = s_bench_bytes - bytes;
+
+    if(b->teardown)
+        b->teardown();
+
+    fprintf(
+        s_bench_out,
+        "%-38s %10zu %12.1f %10.2f %10.1f\n",
+        b->name,
+        iters,
+        (double) elapsed / iters,
+        (double) syscalls / iters,
+        (double) bytes / iters
+    );
+    fflush(s_bench_out);
+}
+
+int main(int argc, char **argv)
+{
+    char const *filter = argc > 1 ? argv[1] : 0;
+
+    s_bench_main = pthread_self();
+    if(s_bench_pty_open() < 0)
+    {
+        perror("cn_api_bench: pseudo terminal");
+        return 1;
+    }
+
+    setenv("CONSOLE_API_INPUT", "tty", 0);
+    if(console_init() != CONSOLE_INIT_SUCCESS)
+    {
+        fprintf(s_bench_out, "cn_api_bench: console_init failed\n");
+        return 1;
+    }
+    __atomic_store_n(&s_bench_answer, 0, __ATOMIC_RELEASE);
+
+    int tty_keys = console_input_backend() == CONSOLE_INPUT_TTY;
+    fprintf(
+        s_bench_out,
+        "%-38s %10s %12s %10s %10s\n",
+        "scenario", "iters", "ns/op", "syscalls/op", "bytes/op"
+    );
+
+    for(size_t i = 0; i < sizeof(s_benches) / sizeof(*s_benches); ++i)
+    {
+        bench const *b = &s_benches[i];
+        if(filter && !strstr(b->name, filter))
+            continue;
+        if(b->tty_keys && !tty_keys)
+        {
+            fprintf(s_bench_out, "%-38s skipped, needs CONSOLE_API_INPUT=tty\n",
+                    b->name);
+            continue;
+        }
+        s_bench_run(b);
+    }
+
+    console_cleanup();
+    return 0;
+}
@@ -2,6 +2,7 @@
 #define CONSOLE_API_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*
  * Details about the Console API can be found
@@ -34,6 +35,15 @@ struct MENU_ENT
  */
 int console_init();
 
+/*
+ * Initializes the API without a terminal, its output goes to an
+ * in-process terminal emulator of width x height cells(80x24 if 0),
+ * and its input is added with console_headless_input
+ * Only available on Linux, returns CONSOLE_INIT_SUCCESS or CONSOLE_INIT_ERR
+ * console_cleanup ends it, like a normal console_init
+ */
+int console_init_headless(int width, int height);
+
 #define CONSOLE_CLEANUP_SUCCESS (0)
 #define CONSOLE_CLEANUP_WARN    (1)
 /*
@@ -50,6 +60,33 @@ int console_cleanup();
 
 void console_clear();
 
+/*
+ * Moves the cursor to column x, row y(origin is 0,0), or by dx columns
+ * and dy rows. The API knows where the cursor is after its own moves,
+ * and writes the shortest escape sequence(or characters) that gets there
+ * Once anything else is written, the next move is an absolute one
+ */
+void console_goto(int x, int y);
+void console_move(int dx, int dy);
+
+/*
+ * The output of the API is buffered, and written to the terminal
+ * in one go by console_flush. The API flushes by itself before waiting
+ * for user input, for anything else, console_flush should be called
+ * once the frame is drawn. This also flushes stdout
+ */
+void console_flush();
+/*
+ * flag=1: Buffer the output until console_flush(default)
+ * flag=0: Write all output right away, stdout is unbuffered too
+ */
+void console_buffered(int flag);
+
+/* Writes len bytes of data through the output buffer of the API */
+void console_write(char const *data, size_t len);
+/* console_write for string literals, their length is known at compile time */
+#define CONSOLE_WRITE_LITERAL(str) console_write("" str, sizeof(str) - 1)
+
 /*
  * Returns 1 if the key is pressed
  * Returns 0 if the key is released
@@ -58,10 +95,53 @@ void console_clear();
  */
 int console_key_state(int key);
 
+#define CONSOLE_INPUT_NATIVE (0) /* Keyboard devices, GetKeyState on Windows */
+#define CONSOLE_INPUT_TTY    (1) /* Keys decoded from the terminal input */
+/*
+ * Returns which backend the key functions use, one of CONSOLE_INPUT_*
+ * On Linux, console_init uses CONSOLE_INPUT_TTY when no keyboard device
+ * can be read, or when the environment variable CONSOLE_API_INPUT
+ * is set to "tty"("native" forces the other backend)
+ */
+int console_input_backend();
+
+#define CONSOLE_KEY_MODE_QUERY (0)
+#define CONSOLE_KEY_MODE_EVENT (1)
+/*
+ * Selects how console_key_state gets key states
+ *   QUERY: The keyboards are asked for their state on each call (default)
+ *   EVENT: Key events are read by console_key_update, which should be called
+ *          once per frame, console_key_state is then a memory lookup
+ * Returns the previous mode
+ */
+int console_key_mode(int mode);
+
+/*
+ * Reads all pending key events without blocking
+ * Returns the number of key state changes, or -1 on error
+ */
+int console_key_update();
+
+/*
+ * Both functions block until a key is pressed then released
+ * They sleep until a key event arrives, and do not use any CPU while waiting
+ */
 void console_wait_click(int key);
 /* Returns which key was pressed */
 int console_wait_clicks(int *keys, size_t kcount);
 
+/*
+ * Same as above, but give up after timeout(in millis)
+ * If timeout=0, they wait forever
+ *
+ * console_wait_click_timeout returns 0 if the key was clicked,
+ * 1 if the timeout was reached, and -1 on error
+ * console_wait_clicks_timeout returns which key was pressed,
+ * or -1 on timeout or error
+ */
+int console_wait_click_timeout(int key, size_t timeout);
+int console_wait_clicks_timeout(int *keys, size_t kcount, size_t timeout);
+
 /*
  * Returns 0 if timout(in millis) was respected, 1 otherwise
  * If timout=0, always returns 0 as if timeout was always respected
@@ -70,6 +150,14 @@ int console_scanf(size_t timeout, char *format, ...);
 
 char *console_fgets(char *s, int len);
 
+/*
+ * Throws away everything that was typed and not read yet
+ * console_fgets and console_scanf keep what was typed before they are
+ * called, programs that only check key states can call this before
+ * them, so that the keys used in the game are not part of the text
+ */
+void console_input_discard();
+
 size_t console_menu(char *prompt, menu_ent *entries, size_t entries_count);
 
 
@@ -86,6 +174,16 @@ size_t console_menu(char *prompt, menu_ent *entries, size_t entries_count);
     #define CONSOLE_KEY_RIGHT   VK_RIGHT
     #define CONSOLE_KEY_LEFT    VK_LEFT
     #define CONSOLE_KEY_ENTER   VK_RETURN
+
+    #define CONSOLE_KEY_PAGEUP   VK_PRIOR
+    #define CONSOLE_KEY_PAGEDOWN VK_NEXT
+    #define CONSOLE_KEY_HOME     VK_HOME
+    #define CONSOLE_KEY_END      VK_END
+
+    #define CONSOLE_KEY_SPACE     VK_SPACE
+    #define CONSOLE_KEY_TAB       VK_TAB
+    #define CONSOLE_KEY_BACKSPACE VK_BACK
+    #define CONSOLE_KEY_ESCAPE    VK_ESCAPE
 #elif defined(__linux)
     #include <linux/input.h>
 
@@ -96,12 +194,105 @@ size_t console_menu(char *prompt, menu_ent *entries, size_t entries_count);
     #define CONSOLE_KEY_RIGHT   KEY_RIGHT
     #define CONSOLE_KEY_LEFT    KEY_LEFT
     #define CONSOLE_KEY_ENTER   KEY_ENTER
+
+    #define CONSOLE_KEY_PAGEUP   KEY_PAGEUP
+    #define CONSOLE_KEY_PAGEDOWN KEY_PAGEDOWN
+    #define CONSOLE_KEY_HOME     KEY_HOME
+    #define CONSOLE_KEY_END      KEY_END
+
+    #define CONSOLE_KEY_SPACE     KEY_SPACE
+    #define CONSOLE_KEY_TAB       KEY_TAB
+    #define CONSOLE_KEY_BACKSPACE KEY_BACKSPACE
+    #define CONSOLE_KEY_ESCAPE    KEY_ESC
+#endif
+
+/* Number of keys that a console_keymap can hold */
+#if defined(_WIN32)
+    #define CONSOLE_KEY_COUNT (256)
+#elif defined(__linux)
+    #define CONSOLE_KEY_COUNT (KEY_MAX + 1)
 #endif
 
+/*
+ * Bitmap of the state of all keys, bit key%8 of bits[key/8]
+ * is set when key is pressed. Its size is rounded up to a multiple
+ * of 8 bytes so that keymaps can be compared a word at a time
+ */
+struct CONSOLE_KEYMAP;
+typedef struct CONSOLE_KEYMAP console_keymap;
+struct CONSOLE_KEYMAP
+{
+    unsigned char bits[(CONSOLE_KEY_COUNT + 63) / 64 * 8];
+};
+
+/* Returns 1 if key is set in map, 0 otherwise */
+#define CONSOLE_KEYMAP_TEST(map, key) \
+    (((map)->bits[(key) / 8] >> ((key) % 8)) & 1)
+
+/*
+ * Fills state with the state of all keys, merged across all keyboards
+ * If not null, pressed and released are filled with the keys that were
+ * pressed or released since the previous call to console_key_snapshot
+ * In CONSOLE_KEY_MODE_EVENT, this also reads pending key events
+ * like console_key_update does
+ * Returns 0 on success, -1 on error
+ */
+int console_key_snapshot(
+    console_keymap *state,
+    console_keymap *pressed,
+    console_keymap *released
+);
+
+/* Input events */
+
+#define CONSOLE_EVENT_RELEASE (0)
+#define CONSOLE_EVENT_PRESS   (1)
+#define CONSOLE_EVENT_REPEAT  (2) /* Auto repeat of a key that is held */
+
+#define CONSOLE_EVENTS_SUCCESS (0)
+#define CONSOLE_EVENTS_ERR     (1)
+
+/*
+ * A key event, time_us is when it happened, in microseconds,
+ * on the same clock as console_time_us, the timestamp given by the kernel
+ */
+struct CONSOLE_EVENT;
+typedef struct CONSOLE_EVENT console_event;
+struct CONSOLE_EVENT
+{
+    int key; /* One of CONSOLE_KEY_* */
+    int type; /* One of CONSOLE_EVENT_* */
+    long long time_us;
+};
+
+/*
+ * Starts a thread that reads all key events and queues them, so that
+ * taps that happen between two key state checks are not lost
+ * It does not change what the other key functions return
+ * Only available on Linux with keyboard devices: on Windows, and with
+ * the terminal key backend, it would take the keys that console_fgets,
+ * console_scanf and the menu filter read, it returns CONSOLE_EVENTS_ERR
+ * Returns CONSOLE_EVENTS_SUCCESS, or CONSOLE_EVENTS_ERR
+ */
+int console_events_start();
+void console_events_stop();
+
+/*
+ * Takes the oldest queued event and puts it in ev, never blocks
+ * Returns 1 if ev was filled, 0 if there was no event
+ */
+int console_poll_event(console_event *ev);
+
+/* Number of events lost because the queue was full */
+size_t console_events_dropped();
+
+/* Current time in microseconds, only useful to compare with other times */
+long long console_time_us();
+
 /* Notes */
-/* Other than alpha numeric keys, Arrow keys, and Enter
-   Console API does not define other keys, as they are not
-   needed by the game */
+/* Other than alpha numeric keys, Arrow keys, Enter, and the
+   Page Up/Page Down/Home/End/Space/Backspace/Escape keys used by menus,
+   Console API does not define other keys, as they are not needed by the game */
 /* CONSOLE_KEY_ALNUM should be passed a number 0-9 or
    an upper case character A-Z, WITHOUT using '' */
 
@@ -120,4 +311,330 @@ void console_style_reset();
 
 void console_title(char const *title);
 
+#define CONSOLE_COLOR_DEPTH_16   (4)
+#define CONSOLE_COLOR_DEPTH_256  (8)
+#define CONSOLE_COLOR_DEPTH_TRUE (24)
+/*
+ * Colors the terminal can show, console_init finds it out from the
+ * CONSOLE_API_COLOR(16, 256 or 24bit), COLORTERM and TERM environment
+ * variables. With 16 or 256 colors, each color is replaced by the
+ * closest one the terminal has, which also makes the escape sequences
+ * shorter. console_color_depth_set changes it, for the next colors
+ */
+int console_color_depth();
+void console_color_depth_set(int depth);
+
+/*
+ * Counters of what the API did since console_init, or the last
+ * console_stats_reset, added up over all threads
+ * They are compiled out with the CNAPI_STATS=OFF CMake option, enabled is
+ * then 0, and all counters stay at 0
+ */
+struct CONSOLE_STATS;
+typedef struct CONSOLE_STATS console_stats;
+struct CONSOLE_STATS
+{
+    int enabled;
+    unsigned long long bytes; /* Bytes written to the terminal */
+    unsigned long long writes; /* System calls that wrote them */
+    /* Escape sequences, by kind */
+    unsigned long long seq_cursor; /* Cursor moves */
+    unsigned long long seq_style; /* Style changes */
+    unsigned long long seq_erase; /* Screen and line erases */
+    unsigned long long seq_other; /* Title, keyboard modes, queries... */
+    unsigned long long frames; /* Frames presented */
+    /* Keyboard device ioctls on Linux, GetKeyState calls on Windows */
+    unsigned long long key_ioctls;
+    unsigned long long key_opens; /* Keyboard devices opened */
+    unsigned long long wait_us; /* Time spent waiting for input, in micros */
+};
+
+void console_stats_get(console_stats *stats);
+void console_stats_reset();
+
+/* Frame pacing */
+
+/*
+ * Frames run at fps per second(0 to not wait between frames, the default)
+ * Each frame has a deadline, one period after the deadline of the previous
+ * frame, console_frame_end sleeps until it
+ */
+void console_frame_rate(int fps);
+/*
+ * All output between console_frame_begin and console_frame_end is kept in
+ * the output buffer, which grows if it has to, and written in one go by
+ * console_frame_end, unless the API waits for user input in between
+ */
+void console_frame_begin();
+
+#define CONSOLE_FRAME_ON_TIME (0)
+#define CONSOLE_FRAME_MISSED  (1)
+/*
+ * Flushes the output, then sleeps until the deadline of the frame
+ * Return values:
+ *   ON_TIME: The frame ended before its deadline
+ *   MISSED: The frame ended after its deadline, the next deadline
+ *           is then one period after now, late frames are not made up for
+ */
+int console_frame_end();
+
+/*
+ * What console_frame_end measured since the frame rate was last set
+ * Jitter is how far from its deadline a frame actually ended
+ * (after sleeping), times are in microseconds
+ */
+struct CONSOLE_FRAME_STATS;
+typedef struct CONSOLE_FRAME_STATS console_frame_stats;
+struct CONSOLE_FRAME_STATS
+{
+    unsigned long long frames; /* Frames ended */
+    unsigned long long missed; /* Frames that ended after their deadline */
+    long long period_us; /* Time between two deadlines, 0 without a rate */
+    long long work_us; /* Time from begin to end of the last frame */
+    long long jitter_us; /* Jitter of the last frame */
+    long long jitter_avg_us;
+    long long jitter_max_us;
+};
+
+void console_frame_stats_get(console_frame_stats *stats);
+
+/* Cell screen */
+
+#define CONSOLE_ATTR_BOLD      (1 << 0)
+#define CONSOLE_ATTR_DIM       (1 << 1)
+#define CONSOLE_ATTR_UNDERLINE (1 << 2)
+#define CONSOLE_ATTR_BLINK     (1 << 3)
+#define CONSOLE_ATTR_SWITCH    (1 << 4) /* Switch foreground and background */
+#define CONSOLE_ATTR_FG        (1 << 5) /* Use fr,fg,fb instead of default */
+#define CONSOLE_ATTR_BG        (1 << 6) /* Use br,bg,bb instead of default */
+
+/*
+ * Style of a cell, attr is a combination of CONSOLE_ATTR_*
+ * Colors are only used if CONSOLE_ATTR_FG/BG is set, otherwise the
+ * default colors of the terminal are used
+ * An all zero console_style is the default style
+ */
+struct CONSOLE_STYLE;
+typedef struct CONSOLE_STYLE console_style;
+struct CONSOLE_STYLE
+{
+    unsigned char fr, fg, fb; /* Foreground color */
+    unsigned char br, bg, bb; /* Background color */
+    unsigned short attr;
+};
+
+/*
+ * Initializers for constant styles, they are built at compile time
+ * and can be set in one call with console_style_set
+ *     static console_style const warn =
+ *         CONSOLE_STYLE_FG(255, 0, 0, CONSOLE_ATTR_BOLD);
+ */
+#define CONSOLE_STYLE_DEFAULT { 0, 0, 0, 0, 0, 0, 0 }
+#define CONSOLE_STYLE_ATTR(attr) { 0, 0, 0, 0, 0, 0, (attr) }
+#define CONSOLE_STYLE_FG(r, g, b, attr) \
+    { (r), (g), (b), 0, 0, 0, (attr) | CONSOLE_ATTR_FG }
+#define CONSOLE_STYLE_BG(r, g, b, attr) \
+    { 0, 0, 0, (r), (g), (b), (attr) | CONSOLE_ATTR_BG }
+#define CONSOLE_STYLE_FG_BG(fr, fg, fb, br, bg, bb, attr) \
+    { (fr), (fg), (fb), (br), (bg), (bb), \
+      (attr) | CONSOLE_ATTR_FG | CONSOLE_ATTR_BG }
+
+/*
+ * Sets/Gets the whole style used by the console_* style functions
+ * Only what changed from the current style is written
+ */
+void console_style_set(console_style const *style);
+void console_style_get(console_style *style);
+
+/*
+ * Number of terminal columns the code point cp takes: 0 for combining
+ * marks and control characters, 2 for wide characters(CJK, emoji), 1
+ * for the others
+ */
+int console_char_width(uint32_t cp);
+/* Number of terminal columns the UTF-8 text str(len bytes) takes */
+size_t console_str_width(char const *str, size_t len);
+/*
+ * Number of bytes at the start of the UTF-8 text str(len bytes) that
+ * fit in cols columns, without cutting a character, or separating it
+ * from the marks that combine with it. The columns they take are
+ * written in *width, unless it is 0
+ */
+size_t console_str_fit(
+    char const *str, size_t len,
+    size_t cols,
+    size_t *width
+);
+
+struct CONSOLE_CELL;
+typedef struct CONSOLE_CELL console_cell;
+/*
+ * A wide character takes two cells, the one on its right has ch 0
+ * Characters that take no column are not put in cells
+ */
+struct CONSOLE_CELL
+{
+    uint32_t ch; /* Unicode code point */
+    console_style style;
+};
+
+#define CONSOLE_SCREEN_SUCCESS (0)
+#define CONSOLE_SCREEN_ERR     (1)
+/*
+ * The screen is a grid of cells that is drawn to(back buffer), then
+ * presented. Presenting only writes the cells that changed since
+ * the last present(front buffer)
+ * Coordinates start at 0,0 on the top left corner
+ *
+ * If width or height is 0, the size of the terminal is used
+ */
+int console_screen_init(int width, int height);
+void console_screen_free();
+void console_screen_size(int *width, int *height);
+
+/* Fills the back buffer with spaces of the default style */
+void console_screen_clear();
+/* style=0 is the default style, cells outside of the screen are ignored */
+void console_screen_put(int x, int y, uint32_t ch, console_style const *style);
+/*
+ * Puts the UTF-8 string str starting at x,y on a single line,
+ * Returns the number of cells that were used
+ */
+int console_screen_print(
+    int x, int y,
+    char const *str,
+    console_style const *style
+);
+
+/* Writes the cells that changed to the terminal and flushes */
+void console_screen_present();
+/* The next present will redraw all cells */
+void console_screen_invalidate();
+
+/*
+ * Drawing from other threads, each thread records cells into a buffer
+ * of its own, without locks, like with console_screen_put/print.
+ * console_draw_commit publishes what the calling thread recorded since
+ * its last commit, and the next console_screen_present puts the commits
+ * of all threads on the screen, in the order they were committed
+ * Up to 16 threads can draw at the same time, each can have up to 8192
+ * cells committed and not presented yet. The buffer of a thread that
+ * exits goes to the next thread that draws, once it was presented
+ * All the other functions of the API should still be called from one
+ * thread at a time
+ */
+void console_draw_put(int x, int y, uint32_t ch, console_style const *style);
+int console_draw_print(
+    int x, int y,
+    char const *str,
+    console_style const *style
+);
+
+#define CONSOLE_DRAW_SUCCESS (0)
+#define CONSOLE_DRAW_FULL    (1)
+#define CONSOLE_DRAW_ERR     (2)
+/*
+ * Return values:
+ *   SUCCESS: The cells will be on the screen after the next present
+ *   FULL: The cells did not fit in the buffer of the thread, none of
+ *         them were committed
+ *   ERR: Too many threads draw, this one has no buffer, the next
+ *        commit looks for one again
+ */
+int console_draw_commit();
+
+/*
+ * A sprite is a rectangle of cells(width*height, row by row) whose
+ * escape sequences and characters are written once by
+ * console_sprite_create, blitting it only copies them to the output
+ * Returns 0 if it could not be allocated
+ */
+struct CONSOLE_SPRITE;
+typedef struct CONSOLE_SPRITE console_sprite;
+console_sprite *console_sprite_create(
+    int width, int height,
+    console_cell const *cells
+);
+void console_sprite_free(console_sprite *sprite);
+/*
+ * Writes the sprite to the terminal with its top left corner at x,y
+ * The cells above or left of the terminal are left out, the ones right
+ * of or below it are only left out by console_sprite_blit_clip
+ * The blit does not go through the cell screen, which does not know
+ * about it, it should be drawn after console_screen_present
+ */
+void console_sprite_blit(console_sprite *sprite, int x, int y);
+/*
+ * Same, but only the cells inside the rectangle of the terminal at
+ * clip_x,clip_y of size clip_w*clip_h are written
+ */
+void console_sprite_blit_clip(
+    console_sprite *sprite,
+    int x, int y,
+    int clip_x, int clip_y,
+    int clip_w, int clip_h
+);
+
+/*
+ * Log pane, shows the last lines of a log in the region of the cell
+ * screen at x,y of size width*height, and can be scrolled back
+ * It keeps up to max_lines lines, whose text(with a byte more per line)
+ * fits in arena_size bytes, the oldest lines are dropped to make room
+ * Returns 0 if it could not be allocated
+ */
+struct CONSOLE_LOG;
+typedef struct CONSOLE_LOG console_log;
+console_log *console_log_create(
+    int x, int y,
+    int width, int height,
+    size_t max_lines,
+    size_t arena_size
+);
+void console_log_free(console_log *log);
+/* Moves the pane to another region, when the terminal was resized */
+void console_log_place(console_log *log, int x, int y, int width, int height);
+/*
+ * Appends the text(len bytes) to the log, each \n starts a new line
+ * Lines longer than the pane are cut when drawn
+ * Can be called from any thread
+ */
+void console_log_append(console_log *log, char const *text, size_t len);
+/*
+ * Scrolls the pane for UP, DOWN, PAGEUP, PAGEDOWN, HOME(the oldest line)
+ * and END(the last line, which the pane then follows), a CONSOLE_KEY_*
+ * from console_poll_event for example
+ * Returns 1 if the key is one of them, 0 otherwise
+ */
+int console_log_key(console_log *log, int key);
+/*
+ * Puts the visible lines on the cell screen, to be written by the next
+ * console_screen_present, which only writes the cells that changed
+ */
+void console_log_draw(console_log *log);
+
+/* Headless terminal, see console_init_headless */
+
+/*
+ * Adds data to the input, as if it was typed in the terminal
+ * (text, control characters, and escape sequences such as \e[A for UP)
+ * Returns the number of bytes that fit in the input buffer
+ */
+size_t console_headless_input(char const *data, size_t len);
+/*
+ * fn is called each time the API reads input, it can add more with
+ * console_headless_input. When no input is left, waits with a timeout
+ * last as long as the timeout, and waits without one fail
+ */
+void console_headless_on_input(void (*fn)(void *ctx), void *ctx);
+/* Cell x,y of the emulated terminal, 0 if it is outside of it */
+console_cell const *console_headless_cell(int x, int y);
+/*
+ * Writes the text of row y in buf, UTF-8 encoded, without the spaces at
+ * its end, and null terminated. Returns the length of the text
+ */
+size_t console_headless_row(int y, char *buf, size_t size);
+void console_headless_cursor(int *x, int *y);
+/* Title set with console_title, "" if none */
+char const *console_headless_title();
+
 #endif
\ No newline at end of file
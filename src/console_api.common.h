@@ -36,13 +36,16 @@
 #include <console_api.h>
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <dirent.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
 
 /* Platform specific includes & defines*/
 #if defined(_WIN32)
@@ -51,15 +54,34 @@
     #include <poll.h>
     #include <fcntl.h>
     #include <signal.h>
+    #include <pthread.h>
     #include <termios.h>
 
     #include <sys/stat.h>
     #include <sys/types.h>
     #include <sys/ioctl.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <sys/inotify.h>
     #include <linux/input.h>
 
+    #define DIR_DEV_INPUT "/dev/input/"
     #define DIR_DEV_INPUT_BY_PATH "/dev/input/by-path/"
 
+    /* Maximum number of keyboards that are kept open at the same time */
+    #define CONSOLE_KBD_MAX (16)
+    /* Size of the buffer of bytes read from the terminal */
+    #define CONSOLE_TTY_IN_SIZE (4096)
+    /* Number of keys the terminal key backend keeps down at the same time */
+    #define CONSOLE_TTY_HELD_MAX (16)
+    /* Number of lines the line editor remembers */
+    #define CONSOLE_HIST_MAX (32)
+    /* Longest line console_scanf reads */
+    #define CONSOLE_LINE_MAX (1024)
+
+    /* First epoll data.u32 that is not used by the keyboard layer */
+    #define CONSOLE_KBD_EPOLL_USER (CONSOLE_KBD_MAX + 1)
+
 #else
     #error "Unsupported platform. This game only supports Linux & Windows"
 #endif
@@ -83,6 +105,191 @@
 	#endif
 #endif
 
+/*
+ * Loads and stores that order the memory accesses around them, used
+ * between threads(the event queue, the draw rings)
+ * MSVC gives volatile accesses these semantics(/volatile:ms)
+ * CONSOLE_S_FETCH_INC(p) increments the long at p, and returns what it was
+ * CONSOLE_S_CAS(p, from, to) sets the size_t at p to to if it was from, and
+ * returns non zero if it did
+ */
+#if defined(_MSC_VER)
+    #define CONSOLE_S_THREAD_LOCAL __declspec(thread)
+    #define CONSOLE_S_LOAD_ACQUIRE(p) (*(size_t volatile *) (p))
+    #define CONSOLE_S_STORE_RELEASE(p, v) (*(size_t volatile *) (p) = (v))
+    #define CONSOLE_S_FETCH_INC(p) (InterlockedIncrement(p) - 1)
+    #define CONSOLE_S_CAS(p, from, to) \
+        ((size_t) InterlockedCompareExchangePointer( \
+            (PVOID volatile *) (p), \
+            (PVOID) (size_t) (to), \
+            (PVOID) (size_t) (from) \
+        ) == (size_t) (from))
+#else
+    #define CONSOLE_S_THREAD_LOCAL __thread
+    #define CONSOLE_S_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+    #define CONSOLE_S_STORE_RELEASE(p, v) \
+        __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+    #define CONSOLE_S_FETCH_INC(p) __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+    #define CONSOLE_S_CAS(p, from, to) \
+        __atomic_compare_exchange_n( \
+            (p), &(size_t) { (from) }, (to), 0, \
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE \
+        )
+#endif
+
+/*
+ * Performance counters, see console_stats.c
+ * CONSOLE_S_STAT(field, n) adds n to field of the calling thread's
+ * console_stats. The counters are compiled out unless CONSOLE_API_STATS
+ * is defined(the CNAPI_STATS CMake option)
+ */
+#if defined(CONSOLE_API_STATS)
+    #if defined(_MSC_VER)
+        #define CONSOLE_S_STAT_LOAD(p) (*(unsigned long long volatile *) (p))
+        #define CONSOLE_S_STAT_STORE(p, v) \
+            (*(unsigned long long volatile *) (p) = (v))
+        #define CONSOLE_S_STAT_ADD(p, n) \
+            InterlockedExchangeAdd64((LONGLONG volatile *) (p), (n))
+    #else
+        #define CONSOLE_S_STAT_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+        #define CONSOLE_S_STAT_STORE(p, v) \
+            __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+        #define CONSOLE_S_STAT_ADD(p, n) \
+            __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+    #endif
+
+    /* Counters of the calling thread, 0 until it counts something */
+    extern CONSOLE_S_THREAD_LOCAL console_stats *console_s_stats_mine;
+    /* 1 if other threads count in console_s_stats_mine too */
+    extern CONSOLE_S_THREAD_LOCAL int console_s_stats_shared;
+    console_stats *console_s_stats_claim();
+
+    #define CONSOLE_S_STAT(field, n) \
+        do \
+        { \
+            console_stats *stats_ = console_s_stats_mine; \
+            if(!stats_) \
+                stats_ = console_s_stats_claim(); \
+            if(console_s_stats_shared) \
+                CONSOLE_S_STAT_ADD(&stats_->field, (n)); \
+            else \
+                CONSOLE_S_STAT_STORE( \
+                    &stats_->field, \
+                    CONSOLE_S_STAT_LOAD(&stats_->field) + (n) \
+                ); \
+        } while(0)
+    /* Time used to measure waits */
+    #define CONSOLE_S_STAT_NOW() console_time_us()
+#else
+    #define CONSOLE_S_STAT(field, n) ((void) sizeof(n))
+    #define CONSOLE_S_STAT_NOW() (0LL)
+#endif
+
+/* Size of the output buffer */
+#define CONSOLE_OBUF_SIZE (64 * 1024)
+/* Size the output buffer can grow to during a frame, see console_frame.c */
+#define CONSOLE_OBUF_FRAME_MAX (16 * 1024 * 1024)
+
+#if defined(__linux)
+/*
+ * A set of open keyboards, see console_kbd.c
+ * The key functions use s_cstate.kbd, the event thread opens
+ * its own set, so that both get every key event
+ */
+struct CONSOLE_KBD_SET;
+typedef struct CONSOLE_KBD_SET console_kbd_set;
+struct CONSOLE_KBD_SET
+{
+    /* Bitmap of all key states merged across all keyboards, it is
+       kept up to date from key events by console_s_linux_kbd_pump */
+    console_keymap kmap;
+
+    /* Keyboards found in DIR_DEV_INPUT_BY_PATH, they are opened once
+       and stay open until a hotplug is reported by inotify */
+    int fds[CONSOLE_KBD_MAX];
+    console_keymap kbd_kmap[CONSOLE_KBD_MAX]; /* Per keyboard bitmap */
+    int dropped[CONSOLE_KBD_MAX]; /* Set after SYN_DROPPED until resync */
+    size_t count;
+    int dir_found; /* set to 1 if DIR_DEV_INPUT_BY_PATH could be opened */
+    int inotify; /* inotify instance watching for hotplugs, -1 if none */
+    int epoll; /* epoll instance over all keyboards and inotify */
+
+    /*
+     * If not null, called by console_s_linux_kbd_pump for every change
+     * of the merged state of a key, and for every auto repeat
+     * value is 0 for release, 1 for press and 2 for auto repeat
+     */
+    void (*on_key)(void *ctx, int key, int value, struct timeval const *time);
+    void *on_key_ctx;
+};
+#endif
+
+
+/* Number of events the event queue holds, must be a power of 2 */
+#define CONSOLE_EVENT_RING (1024)
+
+/*
+ * Queue of key events, see console_events.c
+ * It is a ring with a single producer, the event thread,
+ * and a single consumer, console_poll_event
+ */
+struct CONSOLE_EVENT_QUEUE;
+typedef struct CONSOLE_EVENT_QUEUE console_event_queue;
+struct CONSOLE_EVENT_QUEUE
+{
+    console_event ring[CONSOLE_EVENT_RING];
+
+    /* Each index is written by one side only, they are kept
+       on separate cache lines so that both sides do not fight over them */
+    size_t head; /* Next event written, by the event thread */
+    char head_pad[64 - sizeof(size_t)];
+    size_t tail; /* Next event read, by console_poll_event */
+    char tail_pad[64 - sizeof(size_t)];
+    size_t dropped; /* Written by the event thread */
+
+    int running;
+    size_t stop; /* Set to 1 to ask the thread to stop */
+#if defined(__linux)
+    pthread_t thread;
+    int wake_fd; /* eventfd, wakes the thread up when it should stop */
+    console_kbd_set kbd; /* The thread's own keyboards */
+#endif
+};
+
+/*
+ * In-process terminal emulator, see console_vt.c
+ * When the API is initialized with console_init_headless, its output
+ * goes to the emulator instead of stdout
+ */
+#define CONSOLE_VT_PARAMS_MAX (16)
+#define CONSOLE_VT_OSC_MAX (256)
+
+struct CONSOLE_VT;
+typedef struct CONSOLE_VT console_vt;
+struct CONSOLE_VT
+{
+    int w, h;
+    console_cell *cells; /* w * h cells, row by row */
+    int cx, cy; /* Cursor, origin is 0,0 */
+    int saved_cx, saved_cy;
+    int wrap; /* 1 when the last column was written, the next cell wraps */
+    int top, bottom; /* Scrolling region, both rows included */
+    console_style style; /* Style of the cells written next */
+
+    /* Parser state */
+    int state;
+    unsigned params[CONSOLE_VT_PARAMS_MAX];
+    size_t param_count;
+    char private; /* <, =, >, or ? at the start of the parameters */
+    uint32_t cp; /* UTF-8 code point being decoded */
+    int cp_left; /* Number of bytes cp still needs */
+
+    /* Operating system commands, \e]...\e\\ */
+    char osc[CONSOLE_VT_OSC_MAX];
+    size_t osc_len;
+    char title[CONSOLE_VT_OSC_MAX];
+};
+
 /* Console state struct */
 struct CONSOLE_STATE;
 typedef struct CONSOLE_STATE console_state;
@@ -91,11 +298,54 @@ struct CONSOLE_STATE
     /* Common fields */
     int init; /* Set to 1 when the structure is initialized */
 
-    /* Console style state, never actually used */
-    int style_fr, style_fg, style_fb; /* Foreground colors */
-    int style_br, style_bg, style_bb; /* Background colors */
-    int style_fb_switch; /* Switch foreground and background */
-    int style_bold, style_dim, style_underline, style_blink;
+    /* Output buffer, see console_output.c */
+    char *obuf;
+    size_t olen, ocap;
+    size_t owrites; /* Incremented on every write to, and drain of obuf */
+    size_t oadds; /* Incremented on every write, by the API or with stdio */
+    int obuffered; /* 0 if all output is flushed right away */
+
+    /* Frame pacing, see console_frame.c */
+    int frame_active; /* 1 between console_frame_begin and end */
+    long long frame_deadline; /* console_time_us time, 0 for none yet */
+    long long frame_begin_us; /* When console_frame_begin was called */
+    long long frame_jitter_sum; /* For frame_stats.jitter_avg_us */
+    console_frame_stats frame_stats;
+
+    /* Cursor position, see console_cursor.c */
+    int cur_x, cur_y; /* cur_x is -1 if the position is not known */
+    size_t cur_oadds; /* oadds when it was set, it is not known once it changes */
+
+    /* Cell screen, see console_screen.c */
+    console_cell *scr_front; /* What the terminal shows */
+    console_cell *scr_back; /* What is drawn for the next present */
+    uint64_t *scr_hash; /* Hashes of the rows of both, for scrolling */
+    int scr_w, scr_h;
+
+    int input_backend; /* One of CONSOLE_INPUT_* */
+    int key_mode; /* One of CONSOLE_KEY_MODE_* */
+    console_event_queue events; /* Filled by the event thread */
+    console_keymap key_snapshot; /* State at the last console_key_snapshot */
+
+    /* Console style state, see console_style.c */
+    console_style style; /* Style set by the console_* style functions */
+    console_style term_style; /* Style the terminal is using */
+    int term_style_known; /* 0 if term_style is not known */
+    int color_depth; /* One of CONSOLE_COLOR_DEPTH_* */
+
+    /* Last style escape sequence, it can be replaced by the next one
+       if nothing was written after it */
+    size_t sgr_off; /* Offset in obuf */
+    size_t sgr_owrites; /* owrites right after it was written */
+    console_style sgr_base; /* term_style before it */
+    int sgr_base_known;
+    int sgr_valid;
+
+    /* Headless terminal, see console_headless.c */
+    int headless; /* 1 if the output goes to vt instead of stdout */
+    console_vt vt;
+    void (*headless_on_input)(void *ctx);
+    void *headless_ctx;
 
     /* Platform specific fields */
 #if defined(_WIN32)
@@ -116,11 +366,260 @@ struct CONSOLE_STATE
     struct termios g_attr; /* Game terminal attributes */
     int org_attr_set; /* set to 1 when stdin_org_attr is valid */
 
-    /* Buffer used by console_key_state for a bitmap of all key states */
-    char kmap[KEY_MAX / 8 + 1];
+    /* Keyboards used by the key functions */
+    console_kbd_set kbd;
+
+    /* Bytes read from the terminal that were not used yet, see console_tty.c */
+    unsigned char tty_in[CONSOLE_TTY_IN_SIZE];
+    size_t tty_len;
+
+    /* Terminal key backend, used when input_backend is CONSOLE_INPUT_TTY */
+    console_keymap tty_kmap; /* Keys that are down */
+    struct
+    {
+        int key;
+        long long release_at; /* console_time_us time it is released at */
+    } tty_held[CONSOLE_TTY_HELD_MAX];
+    size_t tty_held_count;
+    long long tty_hold_us; /* How long keys stay down without releases */
+    int tty_kitty; /* 1 if the kitty keyboard protocol is enabled */
+
+    /* Lines entered in console_fgets/console_scanf, most recent last */
+    char *hist[CONSOLE_HIST_MAX];
+    size_t hist_count;
 #endif
 };
 
 extern console_state s_cstate;
 
+/* Internal functions */
+/* Adds output to the output buffer */
+void console_s_out_write(char const *data, size_t len);
+void console_s_out_str(char const *str);
+/*
+ * Returns a pointer where len bytes can be written directly, they are
+ * added to the output by console_s_out_commit(ptr, written bytes)
+ * Nothing else should be written in between
+ */
+char *console_s_out_reserve(size_t len);
+void console_s_out_commit(char const *data, size_t len);
+/* Writes the output buffer to the terminal, but not stdout's buffer */
+void console_s_out_drain();
+/* Makes sure what the program wrote with stdio comes before our output */
+void console_s_out_order();
+/*
+ * Returns 1 if nothing was written since s_cstate.owrites was owrites,
+ * neither by the API nor with stdio. The data written since then
+ * is still in obuf, and can be taken back by decreasing olen
+ */
+int console_s_out_untouched(size_t owrites);
+
+/*
+ * Escape sequence encoder, see console_encode.c
+ * All functions return the number of bytes written to out
+ */
+/* Writes n in decimal, out should have room for 3 bytes */
+size_t console_s_enc_u8(char *out, unsigned char n);
+size_t console_s_enc_uint(char *out, unsigned n);
+/* Moves the cursor to row,col (origin is 1,1) */
+size_t console_s_enc_cup(char *out, unsigned row, unsigned col);
+/* Writes \e[nX, X being final, out should have room for 13 bytes */
+size_t console_s_enc_csi_n(char *out, unsigned n, char final);
+/* Encodes cp in UTF-8, out should have room for 4 bytes */
+size_t console_s_enc_utf8(char *out, uint32_t cp);
+/*
+ * Decodes one UTF-8 sequence of str into cp, returns the number of bytes
+ * used, invalid sequences are decoded as U+FFFD
+ */
+size_t console_s_dec_utf8(char const *str, uint32_t *cp);
+/*
+ * Offset of the character after the one at pos in the UTF-8 text str
+ * (len bytes), or before it, the marks that combine with a character
+ * are skipped with it, see console_width.c
+ */
+size_t console_s_char_next(char const *str, size_t len, size_t pos);
+size_t console_s_char_prev(char const *str, size_t pos);
+
+/*
+ * Colors for terminals without 24-bit colors, see console_color.c
+ * depth is one of CONSOLE_COLOR_DEPTH_*
+ */
+/* Color depth the terminal is likely to have */
+int console_s_color_detect();
+/* Sets rgb to color n of the 256 colors, as xterm shows them by default */
+void console_s_color256(unsigned n, unsigned char rgb[3]);
+/* Closest color to rgb of the 16 or 256 colors */
+unsigned char console_s_color_index(int depth, unsigned char const rgb[3]);
+/* Replaces rgb by the closest color the terminal has */
+void console_s_color_quantize(int depth, unsigned char rgb[3]);
+
+/*
+ * Moves the cursor to x,y(origin is 0,0), with the shortest escape
+ * sequence from where it is, see console_cursor.c
+ * row is the cells the terminal shows on row y, if they are known, or 0
+ */
+void console_s_cursor_goto(int x, int y, console_cell const *row);
+/*
+ * Tells where the cursor is after what was just written, x=-1 if
+ * it is not known
+ */
+void console_s_cursor_set(int x, int y);
+
+/* Sets up vt with blank cells, returns 0 on success */
+int console_s_vt_init(console_vt *vt, int width, int height);
+void console_s_vt_free(console_vt *vt);
+/* Runs the output of the API through vt */
+void console_s_vt_feed(console_vt *vt, char const *data, size_t len);
+
+/* Sets up/ends the headless terminal, see console_headless.c */
+int console_s_headless_open(int width, int height);
+void console_s_headless_close();
+
+/* Gets the size of the terminal window, returns 0 on success */
+int console_s_term_size(int *width, int *height);
+/*
+ * Makes the terminal use style, writing only what changed from
+ * the style it is currently using
+ */
+void console_s_style_apply(console_style const *style);
+/* Returns 1 if the terminal is already using style */
+int console_s_style_is_current(console_style const *style);
+/* Longest escape sequence console_s_style_encode writes */
+#define CONSOLE_S_SGR_MAX (96)
+/*
+ * Writes in seq the escape sequence that changes the terminal from style
+ * from(0 to start from a reset) to style to, without writing it
+ * Returns its length, 0 if the style does not change
+ */
+size_t console_s_style_encode(
+    char *seq,
+    console_style const *from,
+    console_style const *to
+);
+/* The terminal was made to use style, without console_s_style_apply */
+void console_s_style_assume(console_style const *style);
+/*
+ * Puts the cells the other threads committed on the screen, see
+ * console_draw.c, called by console_screen_present
+ */
+void console_s_draw_apply();
+
+/*
+ * Search index of the entries of a menu, see console_menu_index.c
+ * matches holds, in order, the indices of the entries that contain query
+ */
+#define CONSOLE_MENU_QUERY_MAX (64)
+
+struct CONSOLE_MENU_INDEX;
+typedef struct CONSOLE_MENU_INDEX console_menu_index;
+struct CONSOLE_MENU_INDEX
+{
+    size_t entries_count;
+    char *text; /* Lower case "name\1detail\0" of every entry */
+    size_t *text_off; /* Offset of the text of each entry */
+    uint32_t *bucket_start; /* Trigram bucket b is bucket_ents[start[b]..start[b + 1]) */
+    uint32_t *bucket_ents;
+
+    char query[CONSOLE_MENU_QUERY_MAX + 1];
+    size_t query_len;
+    size_t *matches;
+    size_t match_count;
+};
+
+/* Builds the index of entries, returns 0 on success */
+int console_s_menu_index_build(
+    console_menu_index *index,
+    menu_ent const *entries,
+    size_t entries_count
+);
+void console_s_menu_index_free(console_menu_index *index);
+/*
+ * Adds the len bytes of text(one UTF-8 encoded character) at the end of
+ * the query, returns 0 if they do not fit
+ */
+int console_s_menu_index_push(
+    console_menu_index *index,
+    char const *text,
+    size_t len
+);
+/* Removes the last character of the query, with all its bytes */
+void console_s_menu_index_pop(console_menu_index *index);
+void console_s_menu_index_clear(console_menu_index *index);
+
+/* ORs src into dst, a word at a time */
+void console_s_keymap_or(console_keymap *dst, console_keymap const *src);
+
+#if defined(__linux)
+/* Opens the inotify watch and does the first keyboard scan */
+void console_s_linux_kbd_open(console_kbd_set *kbds);
+/* Closes all keyboards and the inotify watch */
+void console_s_linux_kbd_close(console_kbd_set *kbds);
+/* (Re)builds the list of open keyboards, returns the keyboard count or -1 */
+int console_s_linux_kbd_scan(console_kbd_set *kbds);
+/* Rescans keyboards if a hotplug was reported, returns 1 if it did */
+int console_s_linux_kbd_hotplug(console_kbd_set *kbds);
+/* Reloads all keyboard bitmaps with EVIOCGKEY and merges them in kmap */
+void console_s_linux_kbd_sync(console_kbd_set *kbds);
+/*
+ * Waits up to timeout millis(-1 to block, 0 to not wait at all)
+ * for key events, and applies them to kmap
+ * Other fds can be added to kbds->epoll with a data.u32 of
+ * CONSOLE_KBD_EPOLL_USER or more, they only wake the wait up
+ * Returns the number of key state changes, or -1 on error
+ */
+int console_s_linux_kbd_pump(console_kbd_set *kbds, int timeout);
+
+/*
+ * A key read from the terminal by console_s_linux_tty_key, it can have
+ *   - key, one of CONSOLE_KEY_* or KEY_DELETE, 0 if it has none
+ *   - text, the UTF-8 encoded code point it types
+ *   - ctrl, for control characters, their letter('C' for Ctrl+C)
+ * type is one of CONSOLE_EVENT_*, terminals only send releases and
+ * repeats with the kitty keyboard protocol
+ * Replies of the terminal to queries(\e[?...) are keys too, reply is
+ * the final byte of the reply, and param its first parameter
+ */
+struct CONSOLE_TTY_KEY;
+typedef struct CONSOLE_TTY_KEY console_tty_key;
+struct CONSOLE_TTY_KEY
+{
+    int key;
+    int type;
+    char ctrl;
+    char text[4];
+    size_t text_len;
+    char reply;
+    unsigned param;
+};
+
+/*
+ * Reads what is available from the terminal into s_cstate.tty_in
+ * waiting up to timeout millis(-1 to block) for something to arrive
+ * Returns the number of bytes read, 0 on timeout and -1 on error
+ */
+int console_s_linux_tty_fill(int timeout);
+/*
+ * Decodes the next key typed in the terminal, waiting until deadline
+ * (in console_time_us microseconds, 0 for no deadline)
+ * Returns 1 when key was filled, 0 on timeout, and -1 on error
+ */
+int console_s_linux_tty_key(console_tty_key *key, long long deadline);
+/* Throws away everything typed in the terminal that was not read yet */
+void console_s_linux_tty_discard();
+
+/* Sets up the terminal key backend, called by console_init */
+void console_s_linux_tty_open();
+void console_s_linux_tty_close();
+/*
+ * Turns the kitty keyboard protocol off(0) and back on(1) if it is used
+ * The line editor needs keys to be sent as text
+ */
+void console_s_linux_tty_kitty(int on);
+/*
+ * Same as console_s_linux_kbd_pump, for the terminal key backend
+ * Reads the keys typed in the terminal, and applies them to tty_kmap
+ */
+int console_s_linux_tty_pump(int timeout);
+#endif
+
 #endif /* CONSOLE_API_INTERNAL_COMMON_H */
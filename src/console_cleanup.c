@@ -5,7 +5,17 @@ int console_cleanup()
     if(s_cstate.init)
     {
         s_cstate.init = 0;
+        console_events_stop();
+#if defined(__linux)
+        if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+            console_s_linux_tty_close();
+#endif
+        // The program may have changed the style without the API, the
+        // terminal is left with a full reset, whatever the API tracked
+        s_cstate.term_style_known = 0;
+        s_cstate.sgr_valid = 0;
         console_style_reset();
+        console_flush();
         int status = CONSOLE_CLEANUP_SUCCESS;
 #if defined(_WIN32)
         // Reset the original terminal configuration
@@ -23,11 +33,33 @@ int console_cleanup()
         // cmd after the program exits
         FlushConsoleInputBuffer(s_cstate.handle_stdin);
 #elif defined(__linux)
+        console_s_linux_kbd_close(&s_cstate.kbd);
+
+        for(size_t i = 0; i < CONSOLE_HIST_MAX; ++i)
+        {
+            free(s_cstate.hist[i]);
+            s_cstate.hist[i] = 0;
+        }
+        s_cstate.hist_count = 0;
+
         // Revert the original terminal config
-        if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &s_cstate.org_attr) < 0)
+        if(
+           s_cstate.org_attr_set
+        && tcsetattr(STDIN_FILENO, TCSAFLUSH, &s_cstate.org_attr) < 0
+        )
             /* In case of error we set the warn return flag */
             status |= CONSOLE_CLEANUP_WARN;
 #endif
+
+        console_screen_free();
+        if(s_cstate.headless)
+            console_s_headless_close();
+
+        // Anything written after this point goes straight to the terminal
+        free(s_cstate.obuf);
+        s_cstate.obuf = 0;
+        s_cstate.olen = s_cstate.ocap = 0;
+
         return status;
     }
 
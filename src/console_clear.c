@@ -11,12 +11,17 @@ void console_clear()
     // and hope the user does not scroll up or down
     // We mitigate this by disabling scroll entirely
     // during console_init
-    printf("\e[1;1H\e[2J");
+    CONSOLE_WRITE_LITERAL("\e[1;1H\e[2J");
+    CONSOLE_S_STAT(seq_cursor, 1);
+    CONSOLE_S_STAT(seq_erase, 1);
 #elif defined(__linux)
     // Escape code meaning
     // \e[x;yH  moves the cursor to x,y(origin is 1,1)
     // \e[3J    clear the terminal scroll
     // \e[2J    clear the terminal screen
-    printf("\e[1;1H\e[3J\e[2J");
+    CONSOLE_WRITE_LITERAL("\e[1;1H\e[3J\e[2J");
+    CONSOLE_S_STAT(seq_cursor, 1);
+    CONSOLE_S_STAT(seq_erase, 2);
 #endif
+    console_s_cursor_set(0, 0);
 }
@@ -0,0 +1,177 @@
+#include "console_api.common.h"
+
+/*
+ * Colors for terminals that do not show 24-bit colors.
+ * A color is replaced by the closest one the terminal has, found through
+ * lookup tables that are built once:
+ *   - 256 colors: the 6x6x6 color cube(16-231), or the gray ramp(232-255)
+ *     The cube level of each channel, and the gray of the average of the
+ *     channels are looked up, then the closest of both is used
+ *     The 16 first colors are left out, terminals often change them
+ *   - 16 colors: the closest color of a 16x16x16 grid, looked up with the
+ *     4 high bits of each channel
+ * The style only keeps the color it was replaced by, so two colors that
+ * end up being the same do not write an escape sequence.
+ */
+
+/* The 16 colors, as xterm shows them by default */
+static unsigned char const s_console_palette[16][3] =
+{
+    { 0, 0, 0 }, { 205, 0, 0 }, { 0, 205, 0 }, { 205, 205, 0 },
+    { 0, 0, 238 }, { 205, 0, 205 }, { 0, 205, 205 }, { 229, 229, 229 },
+    { 127, 127, 127 }, { 255, 0, 0 }, { 0, 255, 0 }, { 255, 255, 0 },
+    { 92, 92, 255 }, { 255, 0, 255 }, { 0, 255, 255 }, { 255, 255, 255 }
+};
+
+/* Levels of the 6x6x6 color cube of the 256 colors */
+static unsigned char const s_console_cube[6] = { 0, 95, 135, 175, 215, 255 };
+
+/* Lookup tables, see above */
+static unsigned char s_console_cube_level[256]; /* 0-5 */
+static unsigned char s_console_gray_level[256]; /* 0-23 */
+static unsigned char s_console_nearest16[16 * 16 * 16];
+static int s_console_color_lut_built;
+
+static int s_console_color_dist(
+    unsigned char const a[3],
+    unsigned char const b[3]
+)
+{
+    int dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+    return dr * dr + dg * dg + db * db;
+}
+
+static void s_console_color_build_lut()
+{
+    for(int v = 0; v < 256; ++v)
+    {
+        int level = 0;
+        while(
+           level < 5
+        && abs(s_console_cube[level + 1] - v) < abs(s_console_cube[level] - v)
+        )
+            ++level;
+        s_console_cube_level[v] = level;
+
+        // The gray ramp goes from 8 to 238, 10 by 10
+        int gray = v < 8 ? 0 : (v - 3) / 10;
+        s_console_gray_level[v] = gray > 23 ? 23 : gray;
+    }
+
+    for(int i = 0; i < 16 * 16 * 16; ++i)
+    {
+        // The middle of the part of the grid i stands for
+        unsigned char rgb[3] = {
+            (i >> 8) * 16 + 8,
+            (i >> 4 & 15) * 16 + 8,
+            (i & 15) * 16 + 8
+        };
+        int best = 0;
+        for(int n = 1; n < 16; ++n)
+            if(
+               s_console_color_dist(rgb, s_console_palette[n])
+             < s_console_color_dist(rgb, s_console_palette[best])
+            )
+                best = n;
+        s_console_nearest16[i] = best;
+    }
+    s_console_color_lut_built = 1;
+}
+
+void console_s_color256(unsigned n, unsigned char rgb[3])
+{
+    if(n < 16)
+        memcpy(rgb, s_console_palette[n], 3);
+    else if(n < 232)
+    {
+        n -= 16;
+        rgb[0] = s_console_cube[n / 36];
+        rgb[1] = s_console_cube[n / 6 % 6];
+        rgb[2] = s_console_cube[n % 6];
+    }
+    else
+        rgb[0] = rgb[1] = rgb[2] = 8 + (n - 232) * 10;
+}
+
+unsigned char console_s_color_index(int depth, unsigned char const rgb[3])
+{
+    if(!s_console_color_lut_built)
+        s_console_color_build_lut();
+
+    if(depth == CONSOLE_COLOR_DEPTH_16)
+        return s_console_nearest16[
+            (rgb[0] >> 4) << 8 | (rgb[1] >> 4) << 4 | rgb[2] >> 4
+        ];
+
+    unsigned char cube[3], gray[3];
+    int cube_n = 16 + s_console_cube_level[rgb[0]] * 36
+                    + s_console_cube_level[rgb[1]] * 6
+                    + s_console_cube_level[rgb[2]];
+    int gray_n = 232 + s_console_gray_level[(rgb[0] + rgb[1] + rgb[2]) / 3];
+    console_s_color256(cube_n, cube);
+    console_s_color256(gray_n, gray);
+
+    return s_console_color_dist(rgb, gray) < s_console_color_dist(rgb, cube)
+         ? gray_n : cube_n;
+}
+
+void console_s_color_quantize(int depth, unsigned char rgb[3])
+{
+    if(depth == CONSOLE_COLOR_DEPTH_TRUE)
+        return;
+    console_s_color256(console_s_color_index(depth, rgb), rgb);
+}
+
+int console_s_color_detect()
+{
+#if defined(_WIN32)
+    // Virtual terminal sequences always have 24-bit colors
+    return CONSOLE_COLOR_DEPTH_TRUE;
+#elif defined(__linux)
+    char const *env = getenv("CONSOLE_API_COLOR");
+    if(env)
+    {
+        if(!strcmp(env, "16"))
+            return CONSOLE_COLOR_DEPTH_16;
+        if(!strcmp(env, "256"))
+            return CONSOLE_COLOR_DEPTH_256;
+        return CONSOLE_COLOR_DEPTH_TRUE;
+    }
+
+    // COLORTERM is set by terminals with 24-bit colors, TERM only tells
+    // which terminal it is like, which says how many colors it has
+    char const *colorterm = getenv("COLORTERM");
+    if(
+       colorterm
+    && (!strcmp(colorterm, "truecolor") || !strcmp(colorterm, "24bit"))
+    )
+        return CONSOLE_COLOR_DEPTH_TRUE;
+
+    char const *term = getenv("TERM");
+    if(term && (strstr(term, "-direct") || strstr(term, "truecolor")))
+        return CONSOLE_COLOR_DEPTH_TRUE;
+    if(term && strstr(term, "256color"))
+        return CONSOLE_COLOR_DEPTH_256;
+    return CONSOLE_COLOR_DEPTH_16;
+#endif
+}
+
+int console_color_depth()
+{
+    return s_cstate.color_depth;
+}
+
+void console_color_depth_set(int depth)
+{
+    if(
+       depth != CONSOLE_COLOR_DEPTH_16
+    && depth != CONSOLE_COLOR_DEPTH_256
+    && depth != CONSOLE_COLOR_DEPTH_TRUE
+    )
+        return;
+    s_cstate.color_depth = depth;
+
+    // The colors the terminal uses were written with the previous depth
+    s_cstate.term_style_known = 0;
+    s_cstate.sgr_valid = 0;
+}
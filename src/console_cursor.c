@@ -0,0 +1,191 @@
+#include "console_api.common.h"
+
+/*
+ * Cursor motion, like ncurses' mvcur. The API knows where the cursor is
+ * as long as only the code that moves it knowingly(this file, the cell
+ * screen, console_clear) wrote since. Anything else added to the output
+ * buffer, or written with stdio, changes s_cstate.oadds, which makes the
+ * position unknown. Style changes do not.
+ *
+ * When the position is known, a move is written with the shortest of:
+ *   - An absolute move, \e[y;xH
+ *   - Relative moves, \e[nA/B/C/D(up, down, right, left)
+ *   - \r to go to the first column, then \n to go down, output processing
+ *     turns it into \r\n, which also lands on the first column without it
+ *   - \b to go one column left
+ *   - The characters that are already between the cursor and where it
+ *     goes, written again, when they are known(the cell screen knows them)
+ * When it is not known, the absolute move is always used.
+ */
+
+/* Longest move, the absolute move is at most 25 bytes, others are shorter */
+#define CURSOR_MOVE_MAX (32)
+
+/* Bytes of \e[nX */
+static size_t s_console_cursor_rel_len(unsigned n)
+{
+    char digits[16];
+    return n == 1 ? 3 : 3 + console_s_enc_uint(digits, n);
+}
+
+/*
+ * Writes in out a move by n(which can be negative) in one direction,
+ * back is the final byte to go towards 0, forth the other way
+ */
+static size_t s_console_cursor_rel(char *out, int n, char back, char forth)
+{
+    return console_s_enc_csi_n(out, n < 0 ? -n : n, n < 0 ? back : forth);
+}
+
+/* Returns 1 if the cells from..to - 1 can be written again as they are */
+static int s_console_cursor_can_rewrite(
+    console_cell const *row,
+    int from, int to
+)
+{
+    for(int x = from; x < to; ++x)
+    {
+        // Only characters that are one byte, and one cell wide
+        if(row[x].ch < 0x20 || row[x].ch > 0x7E)
+            return 0;
+        if(!console_s_style_is_current(&row[x].style))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Writes in out the shortest way to go from column from to column to
+ * on row, returns its length, it is never longer than 13 bytes
+ */
+static size_t s_console_cursor_h(
+    char *out,
+    int from, int to,
+    console_cell const *row
+)
+{
+    if(from == to)
+        return 0;
+
+    if(to < from)
+    {
+        unsigned n = from - to;
+        if(n >= s_console_cursor_rel_len(n))
+            return console_s_enc_csi_n(out, n, 'D');
+        memset(out, '\b', n);
+        return n;
+    }
+
+    unsigned n = to - from;
+    if(
+       n >= s_console_cursor_rel_len(n)
+    || !row
+    || !s_console_cursor_can_rewrite(row, from, to)
+    )
+        return console_s_enc_csi_n(out, n, 'C');
+    for(int x = from; x < to; ++x)
+        out[x - from] = row[x].ch;
+    return n;
+}
+
+void console_s_cursor_goto(int x, int y, console_cell const *row)
+{
+    // What was written with stdio has to be taken into account first
+    console_s_out_order();
+
+    int known = s_cstate.cur_x >= 0 && s_cstate.cur_oadds == s_cstate.oadds;
+    if(known && s_cstate.cur_x == x && s_cstate.cur_y == y)
+        return;
+
+    char best[CURSOR_MOVE_MAX];
+    size_t best_len = console_s_enc_cup(best, y + 1, x + 1);
+
+    if(known)
+    {
+        char seq[CURSOR_MOVE_MAX];
+        size_t len = 0;
+        int dy = y - s_cstate.cur_y;
+
+        // Up or down first, then left or right on row y
+        if(dy)
+            len = s_console_cursor_rel(seq, dy, 'A', 'B');
+        len += s_console_cursor_h(seq + len, s_cstate.cur_x, x, row);
+        if(len < best_len)
+        {
+            memcpy(best, seq, len);
+            best_len = len;
+        }
+
+        // From the first column
+        len = 0;
+        seq[len++] = '\r';
+        if(dy > 0 && (unsigned) dy < s_console_cursor_rel_len(dy))
+        {
+            memset(seq + len, '\n', dy);
+            len += dy;
+        }
+        else if(dy)
+            len += s_console_cursor_rel(seq + len, dy, 'A', 'B');
+        len += s_console_cursor_h(seq + len, 0, x, row);
+        if(len < best_len)
+        {
+            memcpy(best, seq, len);
+            best_len = len;
+        }
+    }
+
+    char *out = console_s_out_reserve(best_len);
+    memcpy(out, best, best_len);
+    console_s_out_commit(out, best_len);
+    CONSOLE_S_STAT(seq_cursor, 1);
+    console_s_cursor_set(x, y);
+}
+
+void console_s_cursor_set(int x, int y)
+{
+    s_cstate.cur_x = x;
+    s_cstate.cur_y = y;
+    s_cstate.cur_oadds = s_cstate.oadds;
+}
+
+void console_goto(int x, int y)
+{
+    if(x < 0)
+        x = 0;
+    if(y < 0)
+        y = 0;
+    console_s_cursor_goto(x, y, 0);
+}
+
+void console_move(int dx, int dy)
+{
+    console_s_out_order();
+
+    if(s_cstate.cur_x >= 0 && s_cstate.cur_oadds == s_cstate.oadds)
+    {
+        int x = s_cstate.cur_x + dx, y = s_cstate.cur_y + dy;
+
+        // The terminal stops the cursor at its edges
+        if(s_cstate.scr_w && x >= s_cstate.scr_w)
+            x = s_cstate.scr_w - 1;
+        if(s_cstate.scr_h && y >= s_cstate.scr_h)
+            y = s_cstate.scr_h - 1;
+        console_goto(x, y);
+        return;
+    }
+
+    // The terminal knows where the cursor is, even if we do not
+    char seq[CURSOR_MOVE_MAX];
+    size_t len = 0;
+    if(dy)
+        len += s_console_cursor_rel(seq, dy, 'A', 'B');
+    if(dx)
+        len += s_console_cursor_rel(seq + len, dx, 'D', 'C');
+    if(!len)
+        return;
+
+    char *out = console_s_out_reserve(len);
+    memcpy(out, seq, len);
+    console_s_out_commit(out, len);
+    CONSOLE_S_STAT(seq_cursor, 1);
+}
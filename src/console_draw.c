@@ -0,0 +1,284 @@
+#include "console_api.common.h"
+
+/*
+ * Drawing to the cell screen from any thread. Each thread that draws gets
+ * a ring of cells of its own, which only it writes to, and only
+ * console_screen_present reads from(a single producer, single consumer
+ * queue, like the event queue), so recording cells takes no lock.
+ *
+ * console_draw_commit gives the cells recorded since the last commit a
+ * number, from a counter shared by all threads, then publishes them.
+ * console_screen_present puts the commits of all threads on the screen
+ * in the order of their numbers, so when two threads draw the same cell,
+ * the last commit wins. A thread can be stopped between taking a number
+ * and publishing its cells, present then stops at that number, and the
+ * later commits wait for the next present.
+ *
+ * Up to DRAW_THREADS threads can have a ring at the same time. When a
+ * thread exits, its ring is left to console_screen_present, which gives it
+ * back once the cells committed in it are presented, and the next thread
+ * that draws takes it. A thread that found no ring looks again when it
+ * commits.
+ */
+
+#define DRAW_THREADS (16)
+/* Cells each thread can have recorded and not presented, a power of 2 */
+#define DRAW_RING_SIZE (8192)
+
+struct DRAW_CMD
+{
+    uint32_t seq; /* Number of the commit it belongs to */
+    uint16_t x, y;
+    console_cell cell;
+};
+
+struct DRAW_RING
+{
+    struct DRAW_CMD cmds[DRAW_RING_SIZE];
+    size_t head; /* End of the committed cells, written by the thread */
+    size_t tail; /* End of the presented cells, written by present */
+    size_t rec; /* End of the recorded cells, only used by the thread */
+    int full; /* The cells recorded since the last commit did not fit */
+    size_t owner; /* One of DRAW_RING_* */
+};
+
+/* Owners of a ring */
+#define DRAW_RING_FREE (0)
+#define DRAW_RING_THREAD (1) /* The thread that draws with it */
+#define DRAW_RING_PRESENT (2) /* Present, until it is drained */
+
+static struct DRAW_RING s_console_draw_rings[DRAW_THREADS];
+static long s_console_draw_seq; /* Number of the next commit */
+static uint32_t s_console_draw_next; /* Next commit to present */
+
+static CONSOLE_S_THREAD_LOCAL struct DRAW_RING *s_console_draw_mine;
+static CONSOLE_S_THREAD_LOCAL int s_console_draw_refused;
+
+/* Called when a thread that has a ring exits, with its ring */
+#if defined(_WIN32)
+static void WINAPI s_console_draw_exit(void *ring)
+#elif defined(__linux)
+static void s_console_draw_exit(void *ring)
+#endif
+{
+    // The cells that were not committed are dropped
+    // present takes the ring, with the commits still in it
+    if(ring)
+        CONSOLE_S_STORE_RELEASE(
+            &((struct DRAW_RING *) ring)->owner,
+            DRAW_RING_PRESENT
+        );
+}
+
+#if defined(_WIN32)
+static INIT_ONCE s_console_draw_once = INIT_ONCE_STATIC_INIT;
+static DWORD s_console_draw_key = FLS_OUT_OF_INDEXES;
+
+static BOOL CALLBACK s_console_draw_key_create(
+    INIT_ONCE *once,
+    void *param,
+    void **ctx
+)
+{
+    (void) once;
+    (void) param;
+    (void) ctx;
+    s_console_draw_key = FlsAlloc(s_console_draw_exit);
+    return TRUE;
+}
+
+/* Makes s_console_draw_exit called when the thread exits, 0 on success */
+static int s_console_draw_on_exit(struct DRAW_RING *ring)
+{
+    InitOnceExecuteOnce(&s_console_draw_once, s_console_draw_key_create, 0, 0);
+    if(s_console_draw_key == FLS_OUT_OF_INDEXES)
+        return -1;
+    return FlsSetValue(s_console_draw_key, ring) ? 0 : -1;
+}
+#elif defined(__linux)
+static pthread_once_t s_console_draw_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_console_draw_key;
+static int s_console_draw_key_err;
+
+static void s_console_draw_key_create()
+{
+    s_console_draw_key_err =
+        pthread_key_create(&s_console_draw_key, s_console_draw_exit);
+}
+
+/* Makes s_console_draw_exit called when the thread exits, 0 on success */
+static int s_console_draw_on_exit(struct DRAW_RING *ring)
+{
+    pthread_once(&s_console_draw_once, s_console_draw_key_create);
+    if(s_console_draw_key_err)
+        return -1;
+    return pthread_setspecific(s_console_draw_key, ring) ? -1 : 0;
+}
+#endif
+
+/* Ring of the calling thread, 0 if there are none left */
+static struct DRAW_RING *s_console_draw_ring()
+{
+    if(s_console_draw_mine || s_console_draw_refused)
+        return s_console_draw_mine;
+
+    for(size_t i = 0; i < DRAW_THREADS; ++i)
+    {
+        struct DRAW_RING *ring = &s_console_draw_rings[i];
+        if(!CONSOLE_S_CAS(&ring->owner, DRAW_RING_FREE, DRAW_RING_THREAD))
+            continue;
+
+        // A ring that was given back is empty, head == tail
+        if(s_console_draw_on_exit(ring))
+        {
+            // It would never be given back
+            CONSOLE_S_STORE_RELEASE(&ring->owner, DRAW_RING_FREE);
+            break;
+        }
+        ring->rec = ring->head;
+        ring->full = 0;
+        s_console_draw_mine = ring;
+        return ring;
+    }
+
+    s_console_draw_refused = 1;
+    return 0;
+}
+
+static void s_console_draw_record(
+    struct DRAW_RING *ring,
+    int x, int y,
+    uint32_t ch,
+    console_style const *style
+)
+{
+    if(x < 0 || y < 0 || x > UINT16_MAX || y > UINT16_MAX)
+        return;
+
+    if(ring->rec - CONSOLE_S_LOAD_ACQUIRE(&ring->tail) >= DRAW_RING_SIZE)
+    {
+        ring->full = 1;
+        return;
+    }
+
+    struct DRAW_CMD *cmd = &ring->cmds[ring->rec % DRAW_RING_SIZE];
+    cmd->x = x;
+    cmd->y = y;
+    cmd->cell.ch = ch;
+    if(style)
+        cmd->cell.style = *style;
+    else
+        memset(&cmd->cell.style, 0, sizeof(cmd->cell.style));
+    ++ring->rec;
+}
+
+void console_draw_put(int x, int y, uint32_t ch, console_style const *style)
+{
+    struct DRAW_RING *ring = s_console_draw_ring();
+    if(ring)
+        s_console_draw_record(ring, x, y, ch, style);
+}
+
+int console_draw_print(
+    int x, int y,
+    char const *str,
+    console_style const *style
+)
+{
+    struct DRAW_RING *ring = s_console_draw_ring();
+    int cells = 0;
+    while(*str)
+    {
+        uint32_t cp;
+        str += console_s_dec_utf8(str, &cp);
+        int width = console_char_width(cp);
+        if(ring && width)
+            s_console_draw_record(ring, x + cells, y, cp, style);
+        cells += width;
+    }
+    return cells;
+}
+
+int console_draw_commit()
+{
+    // The cells recorded without a ring were dropped, a ring may have
+    // been given back since, for the next commit
+    if(s_console_draw_refused)
+    {
+        s_console_draw_refused = 0;
+        s_console_draw_ring();
+        return CONSOLE_DRAW_ERR;
+    }
+
+    struct DRAW_RING *ring = s_console_draw_ring();
+    if(!ring)
+        return CONSOLE_DRAW_ERR;
+
+    if(ring->full)
+    {
+        // Half of a commit would show a pane half updated
+        ring->rec = ring->head;
+        ring->full = 0;
+        return CONSOLE_DRAW_FULL;
+    }
+    if(ring->rec == ring->head)
+        return CONSOLE_DRAW_SUCCESS;
+
+    uint32_t seq = (uint32_t) CONSOLE_S_FETCH_INC(&s_console_draw_seq);
+    for(size_t i = ring->head; i != ring->rec; ++i)
+        ring->cmds[i % DRAW_RING_SIZE].seq = seq;
+    CONSOLE_S_STORE_RELEASE(&ring->head, ring->rec);
+    return CONSOLE_DRAW_SUCCESS;
+}
+
+/* Gives back the rings of the threads that exited, once they are drained */
+static void s_console_draw_release()
+{
+    for(size_t i = 0; i < DRAW_THREADS; ++i)
+    {
+        struct DRAW_RING *ring = &s_console_draw_rings[i];
+        // The thread published its last commit before it left the ring
+        if(
+           CONSOLE_S_LOAD_ACQUIRE(&ring->owner) == DRAW_RING_PRESENT
+        && CONSOLE_S_LOAD_ACQUIRE(&ring->head) == ring->tail
+        )
+            CONSOLE_S_STORE_RELEASE(&ring->owner, DRAW_RING_FREE);
+    }
+}
+
+void console_s_draw_apply()
+{
+    while(1)
+    {
+        // The ring the next commit is in, it is the oldest commit of it
+        struct DRAW_RING *ring = 0;
+        size_t head = 0;
+        for(size_t i = 0; i < DRAW_THREADS && !ring; ++i)
+        {
+            struct DRAW_RING *r = &s_console_draw_rings[i];
+            head = CONSOLE_S_LOAD_ACQUIRE(&r->head);
+            if(
+               head != r->tail
+            && r->cmds[r->tail % DRAW_RING_SIZE].seq == s_console_draw_next
+            )
+                ring = r;
+        }
+        if(!ring)
+            break;
+
+        size_t tail = ring->tail;
+        while(
+           tail != head
+        && ring->cmds[tail % DRAW_RING_SIZE].seq == s_console_draw_next
+        )
+        {
+            struct DRAW_CMD *cmd = &ring->cmds[tail % DRAW_RING_SIZE];
+            console_screen_put(cmd->x, cmd->y, cmd->cell.ch, &cmd->cell.style);
+            ++tail;
+        }
+        CONSOLE_S_STORE_RELEASE(&ring->tail, tail);
+        ++s_console_draw_next;
+    }
+
+    s_console_draw_release();
+}
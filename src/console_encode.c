@@ -0,0 +1,195 @@
+#include "console_api.common.h"
+
+/*
+ * Escape sequences are encoded straight into the output buffer, without
+ * going through printf. Numbers in escape sequences are mostly color
+ * components or style codes, which are all 0-255, so their decimal
+ * representation is copied from a table instead of being computed.
+ */
+
+static struct
+{
+    unsigned char len;
+    char str[3];
+} const s_dec_table[256] =
+{
+    { 1, "0" }, { 1, "1" }, { 1, "2" }, { 1, "3" }, { 1, "4" },
+    { 1, "5" }, { 1, "6" }, { 1, "7" }, { 1, "8" }, { 1, "9" },
+    { 2, "10" }, { 2, "11" }, { 2, "12" }, { 2, "13" }, { 2, "14" },
+    { 2, "15" }, { 2, "16" }, { 2, "17" }, { 2, "18" }, { 2, "19" },
+    { 2, "20" }, { 2, "21" }, { 2, "22" }, { 2, "23" }, { 2, "24" },
+    { 2, "25" }, { 2, "26" }, { 2, "27" }, { 2, "28" }, { 2, "29" },
+    { 2, "30" }, { 2, "31" }, { 2, "32" }, { 2, "33" }, { 2, "34" },
+    { 2, "35" }, { 2, "36" }, { 2, "37" }, { 2, "38" }, { 2, "39" },
+    { 2, "40" }, { 2, "41" }, { 2, "42" }, { 2, "43" }, { 2, "44" },
+    { 2, "45" }, { 2, "46" }, { 2, "47" }, { 2, "48" }, { 2, "49" },
+    { 2, "50" }, { 2, "51" }, { 2, "52" }, { 2, "53" }, { 2, "54" },
+    { 2, "55" }, { 2, "56" }, { 2, "57" }, { 2, "58" }, { 2, "59" },
+    { 2, "60" }, { 2, "61" }, { 2, "62" }, { 2, "63" }, { 2, "64" },
+    { 2, "65" }, { 2, "66" }, { 2, "67" }, { 2, "68" }, { 2, "69" },
+    { 2, "70" }, { 2, "71" }, { 2, "72" }, { 2, "73" }, { 2, "74" },
+    { 2, "75" }, { 2, "76" }, { 2, "77" }, { 2, "78" }, { 2, "79" },
+    { 2, "80" }, { 2, "81" }, { 2, "82" }, { 2, "83" }, { 2, "84" },
+    { 2, "85" }, { 2, "86" }, { 2, "87" }, { 2, "88" }, { 2, "89" },
+    { 2, "90" }, { 2, "91" }, { 2, "92" }, { 2, "93" }, { 2, "94" },
+    { 2, "95" }, { 2, "96" }, { 2, "97" }, { 2, "98" }, { 2, "99" },
+    { 3, "100" }, { 3, "101" }, { 3, "102" }, { 3, "103" }, { 3, "104" },
+    { 3, "105" }, { 3, "106" }, { 3, "107" }, { 3, "108" }, { 3, "109" },
+    { 3, "110" }, { 3, "111" }, { 3, "112" }, { 3, "113" }, { 3, "114" },
+    { 3, "115" }, { 3, "116" }, { 3, "117" }, { 3, "118" }, { 3, "119" },
+    { 3, "120" }, { 3, "121" }, { 3, "122" }, { 3, "123" }, { 3, "124" },
+    { 3, "125" }, { 3, "126" }, { 3, "127" }, { 3, "128" }, { 3, "129" },
+    { 3, "130" }, { 3, "131" }, { 3, "132" }, { 3, "133" }, { 3, "134" },
+    { 3, "135" }, { 3, "136" }, { 3, "137" }, { 3, "138" }, { 3, "139" },
+    { 3, "140" }, { 3, "141" }, { 3, "142" }, { 3, "143" }, { 3, "144" },
+    { 3, "145" }, { 3, "146" }, { 3, "147" }, { 3, "148" }, { 3, "149" },
+    { 3, "150" }, { 3, "151" }, { 3, "152" }, { 3, "153" }, { 3, "154" },
+    { 3, "155" }, { 3, "156" }, { 3, "157" }, { 3, "158" }, { 3, "159" },
+    { 3, "160" }, { 3, "161" }, { 3, "162" }, { 3, "163" }, { 3, "164" },
+    { 3, "165" }, { 3, "166" }, { 3, "167" }, { 3, "168" }, { 3, "169" },
+    { 3, "170" }, { 3, "171" }, { 3, "172" }, { 3, "173" }, { 3, "174" },
+    { 3, "175" }, { 3, "176" }, { 3, "177" }, { 3, "178" }, { 3, "179" },
+    { 3, "180" }, { 3, "181" }, { 3, "182" }, { 3, "183" }, { 3, "184" },
+    { 3, "185" }, { 3, "186" }, { 3, "187" }, { 3, "188" }, { 3, "189" },
+    { 3, "190" }, { 3, "191" }, { 3, "192" }, { 3, "193" }, { 3, "194" },
+    { 3, "195" }, { 3, "196" }, { 3, "197" }, { 3, "198" }, { 3, "199" },
+    { 3, "200" }, { 3, "201" }, { 3, "202" }, { 3, "203" }, { 3, "204" },
+    { 3, "205" }, { 3, "206" }, { 3, "207" }, { 3, "208" }, { 3, "209" },
+    { 3, "210" }, { 3, "211" }, { 3, "212" }, { 3, "213" }, { 3, "214" },
+    { 3, "215" }, { 3, "216" }, { 3, "217" }, { 3, "218" }, { 3, "219" },
+    { 3, "220" }, { 3, "221" }, { 3, "222" }, { 3, "223" }, { 3, "224" },
+    { 3, "225" }, { 3, "226" }, { 3, "227" }, { 3, "228" }, { 3, "229" },
+    { 3, "230" }, { 3, "231" }, { 3, "232" }, { 3, "233" }, { 3, "234" },
+    { 3, "235" }, { 3, "236" }, { 3, "237" }, { 3, "238" }, { 3, "239" },
+    { 3, "240" }, { 3, "241" }, { 3, "242" }, { 3, "243" }, { 3, "244" },
+    { 3, "245" }, { 3, "246" }, { 3, "247" }, { 3, "248" }, { 3, "249" },
+    { 3, "250" }, { 3, "251" }, { 3, "252" }, { 3, "253" }, { 3, "254" },
+    { 3, "255" },
+};
+
+size_t console_s_enc_u8(char *out, unsigned char n)
+{
+    // All 3 bytes are always copied, only len of them are kept
+    memcpy(out, s_dec_table[n].str, 3);
+    return s_dec_table[n].len;
+}
+
+size_t console_s_enc_uint(char *out, unsigned n)
+{
+    if(n < 256)
+        return console_s_enc_u8(out, n);
+
+    // Digits are generated backwards, then copied in order
+    char digits[16];
+    size_t len = 0;
+    while(n)
+    {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    }
+    for(size_t i = 0; i < len; ++i)
+        out[i] = digits[len - 1 - i];
+    return len;
+}
+
+size_t console_s_enc_cup(char *out, unsigned row, unsigned col)
+{
+    // Escape code meaning
+    // \e[y;xH  moves the cursor to x,y(origin is 1,1)
+    size_t len = 0;
+    out[len++] = '\e';
+    out[len++] = '[';
+    len += console_s_enc_uint(out + len, row);
+    out[len++] = ';';
+    len += console_s_enc_uint(out + len, col);
+    out[len++] = 'H';
+    return len;
+}
+
+size_t console_s_enc_csi_n(char *out, unsigned n, char final)
+{
+    // n is left out when it is 1, which is what it means by default
+    size_t len = 0;
+    out[len++] = '\e';
+    out[len++] = '[';
+    if(n != 1)
+        len += console_s_enc_uint(out + len, n);
+    out[len++] = final;
+    return len;
+}
+
+size_t console_s_enc_utf8(char *out, uint32_t cp)
+{
+    if(cp < 0x80)
+    {
+        out[0] = cp;
+        return 1;
+    }
+    if(cp < 0x800)
+    {
+        out[0] = 0xC0 | cp >> 6;
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if(cp < 0x10000)
+    {
+        out[0] = 0xE0 | cp >> 12;
+        out[1] = 0x80 | (cp >> 6 & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | cp >> 18;
+    out[1] = 0x80 | (cp >> 12 & 0x3F);
+    out[2] = 0x80 | (cp >> 6 & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+size_t console_s_dec_utf8(char const *str, uint32_t *cp)
+{
+    unsigned char const *s = (unsigned char const *) str;
+
+    if(s[0] < 0x80)
+    {
+        *cp = s[0];
+        return 1;
+    }
+
+    size_t len;
+    uint32_t c;
+    if((s[0] & 0xE0) == 0xC0)
+    {
+        len = 2;
+        c = s[0] & 0x1F;
+    }
+    else if((s[0] & 0xF0) == 0xE0)
+    {
+        len = 3;
+        c = s[0] & 0x0F;
+    }
+    else if((s[0] & 0xF8) == 0xF0)
+    {
+        len = 4;
+        c = s[0] & 0x07;
+    }
+    else
+    {
+        // Invalid first byte, it is replaced by U+FFFD
+        *cp = 0xFFFD;
+        return 1;
+    }
+
+    for(size_t i = 1; i < len; ++i)
+    {
+        if((s[i] & 0xC0) != 0x80)
+        {
+            // Truncated sequence
+            *cp = 0xFFFD;
+            return i;
+        }
+        c = c << 6 | (s[i] & 0x3F);
+    }
+
+    *cp = c;
+    return len;
+}
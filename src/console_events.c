@@ -0,0 +1,197 @@
+#include "console_api.common.h"
+
+/*
+ * Key state functions only tell whether a key is down when they are
+ * called, a key pressed and released between two calls is never seen.
+ * The event thread reads every key event as soon as it happens, and queues
+ * it with its timestamp in s_cstate.events.
+ *
+ * The queue is a ring with one producer(the event thread) and one
+ * consumer(console_poll_event), so it needs no lock:
+ *   - The producer writes an event at head, then publishes it
+ *     by storing head + 1 with release ordering
+ *   - The consumer reads head with acquire ordering, which makes the
+ *     events before it visible, reads the event at tail, then frees
+ *     its slot by storing tail + 1 with release ordering
+ * Polling an event is then a few memory accesses, it never makes a
+ * system call, nor waits for the event thread.
+ *
+ * On Linux, the thread opens its own set of keyboards, every open evdev
+ * file gets its own copy of the events, so the key functions still see all
+ * of them. There is no such copy of the console input on Windows, and the
+ * terminal key backend reads stdin, the thread is not available with them.
+ */
+
+#define EVENT_RING_MASK (CONSOLE_EVENT_RING - 1)
+
+long long console_time_us()
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER freq;
+    if(!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart / freq.QuadPart * 1000000
+         + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+#elif defined(__linux)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+#if defined(__linux)
+/* Called by the event thread only */
+static void s_console_events_push(int key, int type, long long time_us)
+{
+    console_event_queue *q = &s_cstate.events;
+
+    size_t head = q->head;
+    size_t tail = CONSOLE_S_LOAD_ACQUIRE(&q->tail);
+
+    // When the queue is full, new events are dropped, the
+    // events that are queued stay in order
+    if(head - tail == CONSOLE_EVENT_RING)
+    {
+        CONSOLE_S_STORE_RELEASE(&q->dropped, q->dropped + 1);
+        return;
+    }
+
+    console_event *ev = &q->ring[head & EVENT_RING_MASK];
+    ev->key = key;
+    ev->type = type;
+    ev->time_us = time_us;
+    CONSOLE_S_STORE_RELEASE(&q->head, head + 1);
+}
+#endif
+
+int console_poll_event(console_event *ev)
+{
+    console_event_queue *q = &s_cstate.events;
+
+    size_t tail = q->tail;
+    if(CONSOLE_S_LOAD_ACQUIRE(&q->head) == tail)
+        return 0;
+
+    *ev = q->ring[tail & EVENT_RING_MASK];
+    CONSOLE_S_STORE_RELEASE(&q->tail, tail + 1);
+    return 1;
+}
+
+size_t console_events_dropped()
+{
+    return CONSOLE_S_LOAD_ACQUIRE(&s_cstate.events.dropped);
+}
+
+#if defined(__linux)
+/* kbds->on_key of the event thread's keyboards */
+static void s_console_linux_events_on_key(
+    void *ctx,
+    int key,
+    int value,
+    struct timeval const *time
+)
+{
+    (void) ctx;
+    // The values of evdev match CONSOLE_EVENT_*
+    s_console_events_push(
+        key,
+        value,
+        (long long) time->tv_sec * 1000000 + time->tv_usec
+    );
+}
+
+static void *s_console_linux_events_thread(void *arg)
+{
+    (void) arg;
+    console_event_queue *q = &s_cstate.events;
+
+    // The thread blocks until key events arrive, or
+    // until console_events_stop writes to wake_fd
+    while(!CONSOLE_S_LOAD_ACQUIRE(&q->stop))
+        if(console_s_linux_kbd_pump(&q->kbd, -1) < 0)
+            break;
+
+    return 0;
+}
+#endif
+
+int console_events_start()
+{
+    console_event_queue *q = &s_cstate.events;
+    if(q->running)
+        return CONSOLE_EVENTS_SUCCESS;
+
+    q->head = 0;
+    q->tail = 0;
+    q->dropped = 0;
+    q->stop = 0;
+
+#if defined(_WIN32)
+    // The thread would have to read the console input, and take the keys
+    // that console_fgets, console_scanf and the menu filter read from it
+    return CONSOLE_EVENTS_ERR;
+#elif defined(__linux)
+    // The terminal key backend reads stdin, which
+    // cannot be shared with another thread
+    if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+        return CONSOLE_EVENTS_ERR;
+
+    q->kbd.on_key = s_console_linux_events_on_key;
+    q->kbd.on_key_ctx = 0;
+    console_s_linux_kbd_open(&q->kbd);
+
+    q->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(q->kbd.epoll < 0 || q->wake_fd < 0)
+        goto fail;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = CONSOLE_KBD_EPOLL_USER;
+    if(epoll_ctl(q->kbd.epoll, EPOLL_CTL_ADD, q->wake_fd, &ev) < 0)
+        goto fail;
+
+    if(pthread_create(&q->thread, 0, s_console_linux_events_thread, 0))
+        goto fail;
+#endif
+
+    q->running = 1;
+    return CONSOLE_EVENTS_SUCCESS;
+
+#if defined(__linux)
+fail:
+    if(q->wake_fd >= 0)
+        close(q->wake_fd);
+    console_s_linux_kbd_close(&q->kbd);
+    return CONSOLE_EVENTS_ERR;
+#endif
+}
+
+void console_events_stop()
+{
+    console_event_queue *q = &s_cstate.events;
+    if(!q->running)
+        return;
+
+    CONSOLE_S_STORE_RELEASE(&q->stop, 1);
+
+#if defined(__linux)
+    // An eventfd write only fails if it is interrupted, if it still
+    // does, the thread is cancelled in the epoll_wait it is blocked in
+    uint64_t one = 1;
+    ssize_t written;
+    do
+        written = write(q->wake_fd, &one, sizeof(one));
+    while(written < 0 && errno == EINTR);
+    if(written != sizeof(one))
+        pthread_cancel(q->thread);
+    pthread_join(q->thread, 0);
+
+    close(q->wake_fd);
+    console_s_linux_kbd_close(&q->kbd);
+#endif
+
+    q->running = 0;
+}
@@ -0,0 +1,95 @@
+#include "console_api.common.h"
+
+/*
+ * Frame pacing, a frame is drawn between console_frame_begin and
+ * console_frame_end, which writes it, then sleeps until its deadline.
+ * Deadlines are absolute, each one is a period after the previous one,
+ * not after the end of the previous frame, so the time spent drawing
+ * and the time a sleep overshoots do not add up from frame to frame.
+ *
+ * On Linux, the sleep is a clock_nanosleep until the deadline itself
+ * (TIMER_ABSTIME), on CLOCK_MONOTONIC, the clock of console_time_us.
+ * Windows only sleeps whole milliseconds, so the last one is spent
+ * giving the processor to other threads until the deadline.
+ */
+
+void console_frame_rate(int fps)
+{
+    memset(&s_cstate.frame_stats, 0, sizeof(s_cstate.frame_stats));
+    s_cstate.frame_jitter_sum = 0;
+    s_cstate.frame_deadline = 0;
+    s_cstate.frame_stats.period_us = fps > 0 ? 1000000 / fps : 0;
+}
+
+void console_frame_begin()
+{
+    s_cstate.frame_active = 1;
+    s_cstate.frame_begin_us = console_time_us();
+
+    // The first frame has no previous deadline to start from
+    if(!s_cstate.frame_deadline)
+        s_cstate.frame_deadline = s_cstate.frame_begin_us
+                                + s_cstate.frame_stats.period_us;
+}
+
+/* Sleeps until deadline, a console_time_us time */
+static void s_console_frame_sleep(long long deadline)
+{
+#if defined(_WIN32)
+    long long left = deadline - console_time_us();
+    if(left > 1000)
+        Sleep((DWORD) (left / 1000 - 1));
+    while(console_time_us() < deadline)
+        SwitchToThread();
+#elif defined(__linux)
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000;
+    ts.tv_nsec = deadline % 1000000 * 1000;
+
+    // A signal interrupts the sleep, the deadline is still the same
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+        ;
+#endif
+}
+
+int console_frame_end()
+{
+    s_cstate.frame_active = 0;
+    console_flush();
+
+    console_frame_stats *stats = &s_cstate.frame_stats;
+    long long now = console_time_us();
+    ++stats->frames;
+    stats->work_us = now - s_cstate.frame_begin_us;
+    if(!stats->period_us)
+        return CONSOLE_FRAME_ON_TIME;
+
+    int status = CONSOLE_FRAME_ON_TIME;
+    long long deadline = s_cstate.frame_deadline;
+    if(now > deadline)
+    {
+        // The next frames are timed from now, instead of rushing
+        // through the frames that were missed to catch up
+        ++stats->missed;
+        status = CONSOLE_FRAME_MISSED;
+        s_cstate.frame_deadline = now + stats->period_us;
+    }
+    else
+    {
+        s_console_frame_sleep(deadline);
+        now = console_time_us();
+        s_cstate.frame_deadline = deadline + stats->period_us;
+    }
+
+    stats->jitter_us = now - deadline;
+    if(stats->jitter_us > stats->jitter_max_us)
+        stats->jitter_max_us = stats->jitter_us;
+    s_cstate.frame_jitter_sum += stats->jitter_us;
+    stats->jitter_avg_us = s_cstate.frame_jitter_sum / (long long) stats->frames;
+    return status;
+}
+
+void console_frame_stats_get(console_frame_stats *stats)
+{
+    *stats = s_cstate.frame_stats;
+}
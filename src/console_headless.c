@@ -0,0 +1,132 @@
+#include "console_api.common.h"
+
+/*
+ * Headless terminal, the API runs without a terminal, for tests and
+ * benchmarks:
+ *   - The output buffer is drained into an emulated terminal(console_vt.c)
+ *     instead of stdout, so the screen can be checked cell by cell
+ *   - The input is whatever the program adds with console_headless_input,
+ *     it is decoded like keys typed in a terminal(console_tty.c)
+ * Nothing waits for a real device, so thousands of frames can be drawn
+ * and checked each second.
+ */
+
+/* Size used when console_init_headless is given 0 */
+#define HEADLESS_DEF_W (80)
+#define HEADLESS_DEF_H (24)
+
+int console_s_headless_open(int width, int height)
+{
+#if defined(_WIN32)
+    (void) width;
+    (void) height;
+    // The key functions read the console input directly on Windows
+    return -1;
+#elif defined(__linux)
+    if(console_s_vt_init(
+           &s_cstate.vt,
+           width ? width : HEADLESS_DEF_W,
+           height ? height : HEADLESS_DEF_H
+       ))
+        return -1;
+
+    s_cstate.headless = 1;
+
+    // Keys are decoded like with the terminal key backend, without
+    // releases, each key is down until the next time keys are read
+    s_cstate.input_backend = CONSOLE_INPUT_TTY;
+    s_cstate.tty_hold_us = 0;
+    return 0;
+#endif
+}
+
+void console_s_headless_close()
+{
+    console_s_vt_free(&s_cstate.vt);
+    s_cstate.headless = 0;
+    s_cstate.headless_on_input = 0;
+    s_cstate.headless_ctx = 0;
+}
+
+size_t console_headless_input(char const *data, size_t len)
+{
+#if defined(_WIN32)
+    (void) data;
+    (void) len;
+    return 0;
+#elif defined(__linux)
+    if(!s_cstate.headless)
+        return 0;
+
+    size_t room = sizeof(s_cstate.tty_in) - s_cstate.tty_len;
+    if(len > room)
+        len = room;
+    memcpy(s_cstate.tty_in + s_cstate.tty_len, data, len);
+    s_cstate.tty_len += len;
+    return len;
+#endif
+}
+
+void console_headless_on_input(void (*fn)(void *ctx), void *ctx)
+{
+    s_cstate.headless_on_input = fn;
+    s_cstate.headless_ctx = ctx;
+}
+
+console_cell const *console_headless_cell(int x, int y)
+{
+    console_vt *vt = &s_cstate.vt;
+    if(!s_cstate.headless || x < 0 || y < 0 || x >= vt->w || y >= vt->h)
+        return 0;
+
+    // What is still in the output buffer has not reached the terminal
+    console_s_out_drain();
+    return &vt->cells[y * vt->w + x];
+}
+
+size_t console_headless_row(int y, char *buf, size_t size)
+{
+    console_vt *vt = &s_cstate.vt;
+    if(!size)
+        return 0;
+    buf[0] = 0;
+    if(!s_cstate.headless || y < 0 || y >= vt->h)
+        return 0;
+
+    console_s_out_drain();
+
+    console_cell const *row = vt->cells + y * vt->w;
+    int end = vt->w;
+    while(end && row[end - 1].ch == ' ')
+        --end;
+
+    size_t len = 0;
+    for(int x = 0; x < end; ++x)
+    {
+        // The right half of a wide character
+        if(!row[x].ch)
+            continue;
+
+        char utf8[4];
+        size_t cp_len = console_s_enc_utf8(utf8, row[x].ch);
+        if(len + cp_len >= size)
+            break;
+        memcpy(buf + len, utf8, cp_len);
+        len += cp_len;
+    }
+    buf[len] = 0;
+    return len;
+}
+
+void console_headless_cursor(int *x, int *y)
+{
+    console_s_out_drain();
+    *x = s_cstate.vt.cx;
+    *y = s_cstate.vt.cy;
+}
+
+char const *console_headless_title()
+{
+    console_s_out_drain();
+    return s_cstate.vt.title;
+}
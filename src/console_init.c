@@ -1,5 +1,67 @@
 #include "console_api.common.h"
 
+/* Resets cstate and allocates the output buffer, returns 0 on success */
+static int s_console_init_state()
+{
+    /* 0 initialize cstate, regardless of platform */
+    memset(&s_cstate, 0, sizeof(s_cstate));
+#if defined(__linux)
+    s_cstate.kbd.inotify = -1;
+    s_cstate.kbd.epoll = -1;
+#endif
+    console_stats_reset();
+    s_cstate.cur_x = -1;
+
+    s_cstate.obuf = malloc(CONSOLE_OBUF_SIZE);
+    if(!s_cstate.obuf)
+        return -1;
+    s_cstate.ocap = CONSOLE_OBUF_SIZE;
+
+    // The headless terminal shows every color
+    s_cstate.color_depth = CONSOLE_COLOR_DEPTH_TRUE;
+    return 0;
+}
+
+/* console_cleanup, with the signature atexit expects */
+static void s_console_cleanup_atexit(void)
+{
+    console_cleanup();
+}
+
+/*
+ * Has console_cleanup run at exit, it is registered by the first
+ * initialization only, as the API can be initialized many times
+ */
+static void s_console_atexit()
+{
+    static int registered;
+    if(registered)
+        return;
+    registered = 1;
+    atexit(s_console_cleanup_atexit);
+}
+
+int console_init_headless(int width, int height)
+{
+    if(s_console_init_state())
+        return CONSOLE_INIT_ERR;
+
+    if(console_s_headless_open(width, height))
+    {
+        free(s_cstate.obuf);
+        s_cstate.obuf = 0;
+        return CONSOLE_INIT_ERR;
+    }
+
+    /* The output is buffered like with a terminal, but stdout
+       is left alone, it does not go to the same place */
+    s_cstate.obuffered = 1;
+    s_cstate.init = 1;
+
+    s_console_atexit();
+    return CONSOLE_INIT_SUCCESS;
+}
+
 int console_init()
 {
     /* If the user is using file redirection,
@@ -7,19 +69,19 @@ int console_init()
     if(!isatty(fileno(stdin)) || !isatty(fileno(stdout)))
         return CONSOLE_INIT_MCAP_NTTY;
 
-    /* 0 initialize cstate, regardless of platform */
-    memset(&s_cstate, 0, sizeof(s_cstate));
-
-    /* Do not use buffering in the game
-       Because by default, unless \n was
-       written to stdout, the output is not
-       guaranteed to be flushed, and the user may not
-       see anything */
-    setbuf(stdout, 0);
+    /* All output is buffered, and only written when
+       console_flush is called, or before waiting for user input
+       stdout is also fully buffered, so that both buffers can be
+       written in the order the data was added in
+       see console_output.c */
+    if(s_console_init_state())
+        return CONSOLE_INIT_ERR;
+    console_buffered(1);
+    s_cstate.color_depth = console_s_color_detect();
 
     s_cstate.init = 1;
 
-    atexit((void(*)()) console_cleanup);
+    s_console_atexit();
 #if defined(_WIN32)
     /*
      * Windows initialization:
@@ -77,6 +139,7 @@ int console_init()
     SetWindowLong(consoleWindow, GWL_STYLE, GetWindowLong(consoleWindow, GWL_STYLE) & ~WS_MAXIMIZEBOX & ~WS_SIZEBOX);
 
     console_clear();
+    console_flush();
 
     return CONSOLE_INIT_SUCCESS;
 #elif defined(__linux)
@@ -145,9 +208,32 @@ int console_init()
         return CONSOLE_INIT_ERR;
     }
 
-    printf("\e[;r");
+    CONSOLE_WRITE_LITERAL("\e[;r");
+    CONSOLE_S_STAT(seq_other, 1);
+
+    // Find the connected keyboards, they are kept open
+    // for console_key_state
+    // If none can be read(no permission, containers, SSH sessions)
+    // keys are decoded from the terminal input instead
+    char const *backend = getenv("CONSOLE_API_INPUT");
+    s_cstate.input_backend = CONSOLE_INPUT_NATIVE;
+    if(!backend || strcmp(backend, "tty"))
+    {
+        console_s_linux_kbd_open(&s_cstate.kbd);
+        if(!s_cstate.kbd.count && (!backend || strcmp(backend, "native")))
+            s_cstate.input_backend = CONSOLE_INPUT_TTY;
+    }
+    else
+        s_cstate.input_backend = CONSOLE_INPUT_TTY;
+
+    if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+    {
+        console_s_linux_kbd_close(&s_cstate.kbd);
+        console_s_linux_tty_open();
+    }
 
     console_clear();
+    console_flush();
 
     return CONSOLE_INIT_SUCCESS;
 #endif
@@ -1,12 +1,15 @@
 #include "console_api.common.h"
 
+#if defined(_WIN32)
 // console_fgets & console_scanf share the same
 // prologue and epilogue where the original
 // terminal configuration is reset
 // Non zero return code means error
 static int s_console_input_prologue()
 {
-#if defined(_WIN32)
+    // The prompt should be visible before asking for input
+    console_flush();
+
     // Discard all previous unprocessed input
     FlushConsoleInputBuffer(s_cstate.handle_stdin);
 
@@ -16,97 +19,333 @@ static int s_console_input_prologue()
     s_cstate.term_txt_input_mode =
         s_cstate.term_org_input_mode ^ ENABLE_MOUSE_INPUT ^ ENABLE_WINDOW_INPUT;
     SetConsoleMode(s_cstate.handle_stdin, s_cstate.term_txt_input_mode);
-#elif defined(__linux)
-    // Load the default original terminal configuration
-    // this also discards everything in stdin that was not read
-    // which is a behavior we want
-    if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &s_cstate.org_attr) < 0)
-        return -1;
-
-    struct termios tmp;
-    tcgetattr(STDIN_FILENO, &tmp);
-
-    if(
-       tmp.c_cflag != s_cstate.org_attr.c_cflag
-    || tmp.c_iflag != s_cstate.org_attr.c_iflag
-    || tmp.c_oflag != s_cstate.org_attr.c_oflag
-    || tmp.c_lflag != s_cstate.org_attr.c_lflag
-    || tmp.c_ispeed != s_cstate.org_attr.c_ispeed
-    || tmp.c_ospeed != s_cstate.org_attr.c_ospeed
-    || tmp.c_line != s_cstate.org_attr.c_line
-    || memcmp(tmp.c_cc, s_cstate.org_attr.c_cc, sizeof(tmp.c_cc))
-    )
-    {
-        return -1;
-    }
-#endif
     return 0;
 }
 
 static int s_console_input_epilogue()
 {
-#if defined(_WIN32)
     // Discard all data in stdin
     FlushConsoleInputBuffer(s_cstate.handle_stdin);
 
     SetConsoleMode(s_cstate.handle_stdin, s_cstate.term_org_input_mode);
+    return 0;
+}
 #elif defined(__linux)
-    // Load the game terminal configuration
-    // also discard any data that was in stdin
-    if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &s_cstate.g_attr) < 0)
-        return -1;
-#endif
+/*
+ * On Linux, text input does not switch the terminal back to its original
+ * configuration, which took a number of tcsetattr calls, and threw away
+ * everything that was typed before the prompt.
+ * Instead, the terminal stays in raw mode, and a line editor reads the keys
+ * from console_tty.c, and echoes the line itself. It supports:
+ *   - LEFT/RIGHT, HOME/END(or Ctrl+A/Ctrl+E) to move in the line
+ *   - BACKSPACE/DELETE to remove characters, Ctrl+U to clear the line
+ *   - UP/DOWN to go through the lines that were entered before
+ * The line is redrawn by moving the cursor back to its start, so lines
+ * that are longer than the terminal is wide are not supported
+ */
+
+/* State of the line being edited */
+struct LINE_EDIT
+{
+    char *line;
+    size_t cap; /* Including the null termination */
+    size_t len;
+    size_t pos; /* Byte offset of the cursor */
+    size_t cur_cells; /* Cells between the start of the line and the cursor */
+};
+
+/* Moves the cursor n cells, to the left if left is set */
+static void s_console_line_move(size_t n, int left)
+{
+    if(!n)
+        return;
+
+    // Escape code meaning
+    // \e[nD moves the cursor n cells left, \e[nC moves it right
+    char *seq = console_s_out_reserve(16);
+    size_t len = 0;
+    seq[len++] = '\e';
+    seq[len++] = '[';
+    len += console_s_enc_uint(seq + len, n);
+    seq[len++] = left ? 'D' : 'C';
+    console_s_out_commit(seq, len);
+    CONSOLE_S_STAT(seq_cursor, 1);
+}
+
+/* Redraws the line from the cursor position pos_from */
+static void s_console_line_redraw(struct LINE_EDIT *ed, size_t pos_from)
+{
+    size_t from_cells = console_str_width(ed->line, pos_from);
+    if(ed->cur_cells > from_cells)
+        s_console_line_move(ed->cur_cells - from_cells, 1);
+    else
+        s_console_line_move(from_cells - ed->cur_cells, 0);
+
+    // Escape code meaning
+    // \e[K clears from the cursor to the end of the line
+    console_s_out_write(ed->line + pos_from, ed->len - pos_from);
+    CONSOLE_WRITE_LITERAL("\e[K");
+    CONSOLE_S_STAT(seq_erase, 1);
+
+    size_t end_cells = from_cells
+                     + console_str_width(ed->line + pos_from, ed->len - pos_from);
+    ed->cur_cells = console_str_width(ed->line, ed->pos);
+    s_console_line_move(end_cells - ed->cur_cells, 1);
+}
+
+/* Moves the cursor to byte offset pos */
+static void s_console_line_goto(struct LINE_EDIT *ed, size_t pos)
+{
+    ed->pos = pos;
+    size_t cells = console_str_width(ed->line, pos);
+    if(cells < ed->cur_cells)
+        s_console_line_move(ed->cur_cells - cells, 1);
+    else
+        s_console_line_move(cells - ed->cur_cells, 0);
+    ed->cur_cells = cells;
+}
+
+/* Replaces the whole line with str */
+static void s_console_line_set(struct LINE_EDIT *ed, char const *str)
+{
+    size_t len = strlen(str);
+    if(len >= ed->cap)
+    {
+        // Do not cut in the middle of a UTF-8 sequence
+        len = ed->cap - 1;
+        while(len && (str[len] & 0xC0) == 0x80)
+            --len;
+    }
+
+    memcpy(ed->line, str, len);
+    ed->line[len] = 0;
+    ed->len = len;
+    ed->pos = len;
+    s_console_line_redraw(ed, 0);
+}
+
+/* Remembers line in the history */
+static void s_console_line_history_add(char const *line)
+{
+    // Empty lines, and the line that was just entered, are not remembered
+    size_t last = (s_cstate.hist_count + CONSOLE_HIST_MAX - 1) % CONSOLE_HIST_MAX;
+    if(!*line || (s_cstate.hist_count && !strcmp(s_cstate.hist[last], line)))
+        return;
+
+    char *copy = malloc(strlen(line) + 1);
+    if(!copy)
+        return;
+    strcpy(copy, line);
+
+    size_t slot = s_cstate.hist_count % CONSOLE_HIST_MAX;
+    free(s_cstate.hist[slot]);
+    s_cstate.hist[slot] = copy;
+    ++s_cstate.hist_count;
 }
 
+/*
+ * Lets the user type a line in ed->line, until ENTER or deadline(0 for none)
+ * Returns 0 when the line was entered, 1 on timeout and -1 on error
+ */
+static int s_console_line_read(struct LINE_EDIT *ed, long long deadline)
+{
+    ed->len = 0;
+    ed->pos = 0;
+    ed->cur_cells = 0;
+    ed->line[0] = 0;
+
+    // Line being typed while going through the history, and how far back
+    // in the history we are(0 is the line being typed)
+    char *draft = 0;
+    size_t hist_back = 0;
+    size_t hist_len = s_cstate.hist_count < CONSOLE_HIST_MAX
+                    ? s_cstate.hist_count
+                    : CONSOLE_HIST_MAX;
+
+    // Keys have to be sent as text while the line is edited
+    console_s_linux_tty_kitty(0);
+
+    int status;
+    while(1)
+    {
+        // Whatever was echoed should be visible while we wait
+        console_flush();
+
+        console_tty_key key;
+        status = console_s_linux_tty_key(&key, deadline);
+        if(status <= 0)
+        {
+            status = status ? -1 : 1;
+            break;
+        }
+
+        // Keys typed before the kitty protocol was turned off
+        // can still be releases
+        if(key.type == CONSOLE_EVENT_RELEASE)
+            continue;
+
+        if(key.text_len)
+        {
+            if(ed->len + key.text_len >= ed->cap)
+                continue;
+            memmove(
+                ed->line + ed->pos + key.text_len,
+                ed->line + ed->pos,
+                ed->len - ed->pos + 1
+            );
+            memcpy(ed->line + ed->pos, key.text, key.text_len);
+            ed->len += key.text_len;
+            ed->pos += key.text_len;
+
+            // Typing at the end of the line is the common case
+            // it only needs the new character to be echoed
+            if(ed->pos == ed->len)
+            {
+                console_s_out_write(key.text, key.text_len);
+                ed->cur_cells += console_str_width(key.text, key.text_len);
+            }
+            else
+                s_console_line_redraw(ed, ed->pos - key.text_len);
+            continue;
+        }
+
+        if(key.ctrl == 'C')
+        {
+            // ISIG is off in raw mode, Ctrl+C does what it
+            // would have done in the original configuration
+            // The program may not survive the signal, the terminal
+            // is left in its original configuration until it returns
+            console_flush();
+            if(s_cstate.org_attr_set)
+                tcsetattr(STDIN_FILENO, TCSANOW, &s_cstate.org_attr);
+            raise(SIGINT);
+            if(s_cstate.org_attr_set)
+                tcsetattr(STDIN_FILENO, TCSANOW, &s_cstate.g_attr);
+            continue;
+        }
+        if(key.ctrl == 'D' && !ed->len)
+        {
+            status = -1;
+            break;
+        }
+        if(key.ctrl == 'A')
+            key.key = CONSOLE_KEY_HOME;
+        else if(key.ctrl == 'E')
+            key.key = CONSOLE_KEY_END;
+        else if(key.ctrl == 'U')
+        {
+            s_console_line_set(ed, "");
+            continue;
+        }
+
+        size_t prev = ed->pos;
+        switch(key.key)
+        {
+            case CONSOLE_KEY_ENTER:
+                status = 0;
+                break;
+            case CONSOLE_KEY_LEFT:
+                s_console_line_goto(ed, console_s_char_prev(ed->line, prev));
+                continue;
+            case CONSOLE_KEY_RIGHT:
+                s_console_line_goto(
+                    ed, console_s_char_next(ed->line, ed->len, prev)
+                );
+                continue;
+            case CONSOLE_KEY_HOME:
+                s_console_line_goto(ed, 0);
+                continue;
+            case CONSOLE_KEY_END:
+                s_console_line_goto(ed, ed->len);
+                continue;
+            case CONSOLE_KEY_BACKSPACE:
+            case KEY_DELETE:
+            {
+                // Both remove one character, with the marks that
+                // combine with it, before or after the cursor
+                size_t from = ed->pos, to = ed->pos;
+                if(key.key == CONSOLE_KEY_BACKSPACE)
+                    from = console_s_char_prev(ed->line, from);
+                else
+                    to = console_s_char_next(ed->line, ed->len, to);
+                if(from == to)
+                    continue;
+
+                memmove(ed->line + from, ed->line + to, ed->len - to + 1);
+                ed->len -= to - from;
+                s_console_line_goto(ed, from);
+                s_console_line_redraw(ed, from);
+                continue;
+            }
+            case CONSOLE_KEY_UP:
+            case CONSOLE_KEY_DOWN:
+            {
+                if(key.key == CONSOLE_KEY_UP && hist_back < hist_len)
+                {
+                    // The line being typed is kept to come back to it
+                    if(!hist_back)
+                    {
+                        free(draft);
+                        draft = malloc(ed->len + 1);
+                        if(draft)
+                            memcpy(draft, ed->line, ed->len + 1);
+                    }
+                    ++hist_back;
+                }
+                else if(key.key == CONSOLE_KEY_DOWN && hist_back)
+                    --hist_back;
+                else
+                    continue;
+
+                size_t slot = (s_cstate.hist_count - hist_back) % CONSOLE_HIST_MAX;
+                s_console_line_goto(ed, 0);
+                s_console_line_set(
+                    ed,
+                    hist_back ? s_cstate.hist[slot] : draft ? draft : ""
+                );
+                continue;
+            }
+            default:
+                continue;
+        }
+        break;
+    }
+
+    free(draft);
+    console_s_linux_tty_kitty(1);
+
+    if(!status)
+    {
+        s_console_line_history_add(ed->line);
+        CONSOLE_WRITE_LITERAL("\n");
+        console_flush();
+    }
+    return status;
+}
+#endif
+
 int console_scanf(size_t timeout, char *format, ...)
 {
+#if defined(_WIN32)
     s_console_input_prologue();
     int timeout_respected = 1;
 
     /* The way we force a timeout depends on the OS */
     if(timeout)
     {
-#if defined(_WIN32)
         /* In windows, we can use WaitForSingleObject,
            which, among other things, can be used to block
            until there is data to be read in STDIN.
         */
+        long long waited = CONSOLE_S_STAT_NOW();
         DWORD result = WaitForSingleObject(s_cstate.handle_stdin, timeout);
+        CONSOLE_S_STAT(wait_us, CONSOLE_S_STAT_NOW() - waited);
 
         if(result == WAIT_FAILED)
             return -1;
 
         if(result == WAIT_TIMEOUT)
             timeout_respected = 0;
-#elif defined(__linux)
-
-        /* The poll system call can let us know
-           which operations are ready to be done
-           on a file while specifying a timeout
-           We use this to see if reading can be
-           done from STDIN with a timeout as
-           specified by the user */
-        struct pollfd pfd;
-
-        pfd.fd = STDIN_FILENO;
-        pfd.events = POLLIN;
-
-        if(poll(&pfd, 1, timeout) < 0)
-            return -1;
-
-        if(
-           pfd.revents & POLLERR
-        || pfd.revents & POLLNVAL
-        || pfd.revents & POLLHUP
-        )
-            return -1;
-
-        // if after timeout stdin was still not ready
-        // to give some data, then it means the user
-        // didn't press enter yet
-        if(!(pfd.revents & POLLIN))
-            timeout_respected = 0;
-#endif
     }
 
     if(timeout_respected)
@@ -122,14 +361,66 @@ int console_scanf(size_t timeout, char *format, ...)
 
     /* The function returns non zero if timeout was not respected */
     return !timeout_respected;
+#elif defined(__linux)
+    /* The line editor waits for keys with poll, which
+       takes a timeout, if the user didn't press enter before it
+       the line is dropped */
+    char line[CONSOLE_LINE_MAX];
+    struct LINE_EDIT ed;
+    ed.line = line;
+    ed.cap = sizeof(line);
+
+    long long deadline = timeout ? console_time_us() + timeout * 1000LL : 0;
+    int status = s_console_line_read(&ed, deadline);
+    if(status)
+        return status;
+
+    va_list vargs;
+    va_start(vargs, format);
+    vsscanf(line, format, vargs);
+    va_end(vargs);
+    return 0;
+#endif
 }
 
 char *console_fgets(char *s, int len)
 {
+    if(len <= 0)
+        return 0;
+    if(len == 1)
+    {
+        // There is only room for the null termination
+        s[0] = 0;
+        return s;
+    }
+#if defined(_WIN32)
     if(s_console_input_prologue())
         return 0;
     scanf(" "); // Skip all leading whitespace
     char *rs = fgets(s, len, stdin);
+    if(!rs)
+        return 0;
+#elif defined(__linux)
+    struct LINE_EDIT ed;
+    ed.line = s;
+    ed.cap = len;
+
+    // Lines with nothing but whitespace are skipped
+    char *rs;
+    do
+    {
+        if(s_console_line_read(&ed, 0))
+            return 0;
+        rs = s;
+        while(isspace((unsigned char) *rs))
+            ++rs;
+    }
+    while(!*rs);
+
+    // Skip all leading whitespace
+    memmove(s, rs, strlen(rs) + 1);
+    rs = s;
+#endif
 
     // Remove all trailing whitespace
     size_t in_len = strlen(rs);
@@ -142,7 +433,18 @@ char *console_fgets(char *s, int len)
             break;
         }
 
+#if defined(_WIN32)
     if(s_console_input_epilogue())
         return 0;
+#endif
     return rs;
 }
+
+void console_input_discard()
+{
+#if defined(_WIN32)
+    FlushConsoleInputBuffer(s_cstate.handle_stdin);
+#elif defined(__linux)
+    console_s_linux_tty_discard();
+#endif
+}
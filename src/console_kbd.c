@@ -0,0 +1,425 @@
+#include "console_api.common.h"
+
+#if defined(__linux)
+/*
+ * Keyboard discovery is expensive, it needs a full walk of
+ * DIR_DEV_INPUT_BY_PATH, and an open/fstat/ioctl for each of its entries.
+ * Instead of doing this for every key query, the keyboards are discovered
+ * once during console_init, and kept open in kbds->fds.
+ * An inotify watch on the directory tells us when a keyboard is plugged or
+ * unplugged, and only then is the directory scanned again.
+ *
+ * All keyboards, and the inotify instance, are also registered in an epoll
+ * instance. This lets console_s_linux_kbd_pump read the stream of key events
+ * of all keyboards at once and keep kbds->kmap up to date, without ever
+ * blocking unless asked to.
+ */
+
+/* epoll data of the inotify instance, keyboards use their index */
+#define KBD_EPOLL_INOTIFY (CONSOLE_KBD_MAX)
+
+/* Current time, on the clock of the key events */
+static struct timeval s_console_linux_kbd_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    struct timeval tv;
+    tv.tv_sec = ts.tv_sec;
+    tv.tv_usec = ts.tv_nsec / 1000;
+    return tv;
+}
+
+/*
+ * Calls kbds->on_key for every key whose merged state is not
+ * the same in prev and kbds->kmap
+ * This is how state changes that did not come from a key event,
+ * like a resync or an unplugged keyboard, are reported
+ */
+static void s_console_linux_kbd_report(
+    console_kbd_set *kbds,
+    console_keymap const *prev,
+    struct timeval const *time
+)
+{
+    if(!kbds->on_key)
+        return;
+
+    for(size_t i = 0; i < sizeof(prev->bits); ++i)
+    {
+        unsigned char diff = prev->bits[i] ^ kbds->kmap.bits[i];
+        for(int b = 0; diff; ++b, diff >>= 1)
+            if(diff & 1)
+                kbds->on_key(
+                    kbds->on_key_ctx,
+                    i * 8 + b,
+                    kbds->kmap.bits[i] >> b & 1,
+                    time
+                );
+    }
+}
+
+static void s_console_linux_kbd_watch(console_kbd_set *kbds)
+{
+    // We watch the by-path directory itself if it exists
+    // If it doesn't (No input device was ever connected), we watch
+    // /dev/input/ instead, so that we learn when by-path gets created
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ATTRIB;
+
+    if(inotify_add_watch(kbds->inotify, DIR_DEV_INPUT_BY_PATH, mask) < 0)
+        inotify_add_watch(kbds->inotify, DIR_DEV_INPUT, IN_CREATE);
+}
+
+void console_s_linux_kbd_open(console_kbd_set *kbds)
+{
+    kbds->count = 0;
+    kbds->dir_found = 0;
+
+    // The inotify instance is non blocking, this way checking
+    // for hotplugs is a single read that fails with EAGAIN
+    // when nothing happened
+    kbds->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    kbds->epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    if(kbds->inotify >= 0)
+    {
+        s_console_linux_kbd_watch(kbds);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = KBD_EPOLL_INOTIFY;
+        if(kbds->epoll >= 0)
+            epoll_ctl(kbds->epoll, EPOLL_CTL_ADD, kbds->inotify, &ev);
+    }
+
+    console_s_linux_kbd_scan(kbds);
+}
+
+/* Rebuilds the merged bitmap from the bitmap of every keyboard */
+static void s_console_linux_kbd_merge(console_kbd_set *kbds)
+{
+    memset(&kbds->kmap, 0, sizeof(kbds->kmap));
+    for(size_t i = 0; i < kbds->count; ++i)
+        console_s_keymap_or(&kbds->kmap, &kbds->kbd_kmap[i]);
+}
+
+static void s_console_linux_kbd_close_all(console_kbd_set *kbds)
+{
+    for(size_t i = 0; i < kbds->count; ++i)
+        close(kbds->fds[i]);
+    kbds->count = 0;
+}
+
+void console_s_linux_kbd_close(console_kbd_set *kbds)
+{
+    s_console_linux_kbd_close_all(kbds);
+
+    if(kbds->inotify >= 0)
+        close(kbds->inotify);
+    kbds->inotify = -1;
+
+    if(kbds->epoll >= 0)
+        close(kbds->epoll);
+    kbds->epoll = -1;
+}
+
+int console_s_linux_kbd_scan(console_kbd_set *kbds)
+{
+    s_console_linux_kbd_close_all(kbds);
+
+    // Iterate over all files in /dev/input/by-path/
+    DIR *evdir = opendir(DIR_DEV_INPUT_BY_PATH);
+
+    kbds->dir_found = evdir != 0;
+    if(!evdir)
+    {
+        s_console_linux_kbd_merge(kbds);
+        return -1;
+    }
+
+    // The same keyboard can be reachable from more than one path
+    // so we remember the device number of the keyboards we open
+    dev_t kbd_devs[CONSOLE_KBD_MAX];
+
+    struct dirent *ent;
+    while((ent = readdir(evdir)) && kbds->count < CONSOLE_KBD_MAX)
+    {
+        // For each file in /dev/input/by-path, we check
+        //   - it is either a link or char device
+        //   - it ends with `kbd`
+        //   - if it is a link, check that it is pointing to a char device
+
+        // check that file is link or char device
+        if(ent->d_type != DT_LNK && ent->d_type != DT_CHR)
+            continue;
+
+        // check that filename ends with `kbd`
+        size_t ent_name_len = strlen(ent->d_name);
+        if(
+           ent_name_len < 3
+        || strcmp(ent->d_name + ent_name_len - 3, "kbd")
+        )
+            continue;
+
+        // open the file, we use Linux system call directly
+        // This is mostly because it is painful to create
+        // the string for the absolute path by hand
+        // instead we use the syscall openat, which
+        // takes a directory file number and the relative path
+        // of the file to that directory.
+
+        // the file is open in read only mode, and non blocking so that
+        // reading its events never blocks when there are none
+        int fkbd = openat(
+            dirfd(evdir),
+            ent->d_name,
+            O_RDONLY | O_NONBLOCK | O_CLOEXEC
+        );
+
+        if(fkbd < 0)
+        {
+            // if there was an error opening the file
+            // simply skip to the next file
+            continue;
+        }
+        CONSOLE_S_STAT(key_opens, 1);
+
+        // fstat returns information about the file
+        // if the file was a link, it will resolve the link
+        // before and return information about the real file
+        struct stat file_info;
+        if(
+           fstat(fkbd, &file_info) < 0
+        || (file_info.st_mode & S_IFMT) != S_IFCHR
+        )
+        {
+            // this file is not a character device file,
+            // as a result, we close and skip to the next device
+            close(fkbd);
+            continue;
+        }
+
+        // skip keyboards we already opened through another path
+        size_t i;
+        for(i = 0; i < kbds->count; ++i)
+            if(kbd_devs[i] == file_info.st_rdev)
+                break;
+        if(i < kbds->count)
+        {
+            close(fkbd);
+            continue;
+        }
+
+        // Here we are sure that the file
+        // is a char dev that is *probably* a keyboard
+        // We make sure it understands EVIOCGKEY once here,
+        // so that key queries do not need to check again
+        // This also gives the initial state of the keyboard
+        // which is then kept up to date by key events
+        // https://stackoverflow.com/a/4225290
+        size_t idx = kbds->count;
+        unsigned char *kbd_kmap = kbds->kbd_kmap[idx].bits;
+        CONSOLE_S_STAT(key_ioctls, 1);
+        if(ioctl(fkbd, EVIOCGKEY(sizeof(kbds->kmap.bits)), kbd_kmap) < 0)
+        {
+            // this device was not a keyboard after all
+            close(fkbd);
+            continue;
+        }
+
+        // Key events are timestamped with the same clock as
+        // s_console_linux_kbd_now, not the wall clock
+        int clock_id = CLOCK_MONOTONIC;
+        ioctl(fkbd, EVIOCSCLOCKID, &clock_id);
+        CONSOLE_S_STAT(key_ioctls, 1);
+
+        if(kbds->epoll >= 0)
+        {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u32 = idx;
+            epoll_ctl(kbds->epoll, EPOLL_CTL_ADD, fkbd, &ev);
+        }
+
+        kbd_devs[idx] = file_info.st_rdev;
+        kbds->fds[idx] = fkbd;
+        kbds->dropped[idx] = 0;
+        ++kbds->count;
+    }
+
+    closedir(evdir);
+
+    s_console_linux_kbd_merge(kbds);
+    return kbds->count;
+}
+
+int console_s_linux_kbd_hotplug(console_kbd_set *kbds)
+{
+    if(kbds->inotify < 0)
+        return 0;
+
+    // We do not care about what the events are, any change
+    // in the directory means the set of keyboards should be rebuilt
+    char evbuf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    while(read(kbds->inotify, evbuf, sizeof(evbuf)) > 0)
+        changed = 1;
+
+    if(!changed)
+        return 0;
+
+    // by-path may have just been created, in which case
+    // we move the watch to it
+    if(!kbds->dir_found)
+        s_console_linux_kbd_watch(kbds);
+
+    // Keys held on a keyboard that was unplugged are released
+    console_keymap prev = kbds->kmap;
+    console_s_linux_kbd_scan(kbds);
+
+    struct timeval now = s_console_linux_kbd_now();
+    s_console_linux_kbd_report(kbds, &prev, &now);
+    return 1;
+}
+
+void console_s_linux_kbd_sync(console_kbd_set *kbds)
+{
+    for(size_t i = 0; i < kbds->count; ++i)
+    {
+        ioctl(
+            kbds->fds[i],
+            EVIOCGKEY(sizeof(kbds->kmap.bits)),
+            kbds->kbd_kmap[i].bits
+        );
+        CONSOLE_S_STAT(key_ioctls, 1);
+        kbds->dropped[i] = 0;
+    }
+
+    s_console_linux_kbd_merge(kbds);
+}
+
+/* Reads all pending events of keyboard idx, returns the number of changes */
+static int s_console_linux_kbd_read(console_kbd_set *kbds, size_t idx)
+{
+    int changes = 0;
+    unsigned char *kbd_kmap = kbds->kbd_kmap[idx].bits;
+    struct input_event evs[64];
+
+    while(1)
+    {
+        ssize_t rd = read(kbds->fds[idx], evs, sizeof(evs));
+
+        // EAGAIN means we read everything, other errors
+        // mean the keyboard is gone, and inotify will tell us
+        if(rd <= 0)
+            break;
+
+        size_t evcount = rd / sizeof(*evs);
+        for(size_t i = 0; i < evcount; ++i)
+        {
+            struct input_event *ev = evs + i;
+
+            struct timeval time;
+#if defined(input_event_sec)
+            time.tv_sec = ev->input_event_sec;
+            time.tv_usec = ev->input_event_usec;
+#else
+            time = ev->time;
+#endif
+
+            // When the kernel buffer of the device overflows
+            // it sends SYN_DROPPED, all events until the next
+            // SYN_REPORT should be ignored, and the state of
+            // the device should be asked for again
+            // https://docs.kernel.org/input/event-codes.html#ev-syn
+            if(ev->type == EV_SYN)
+            {
+                if(ev->code == SYN_DROPPED)
+                    kbds->dropped[idx] = 1;
+                else if(ev->code == SYN_REPORT && kbds->dropped[idx])
+                {
+                    ioctl(
+                        kbds->fds[idx],
+                        EVIOCGKEY(sizeof(kbds->kmap.bits)),
+                        kbd_kmap
+                    );
+                    CONSOLE_S_STAT(key_ioctls, 1);
+                    kbds->dropped[idx] = 0;
+
+                    console_keymap prev = kbds->kmap;
+                    s_console_linux_kbd_merge(kbds);
+                    s_console_linux_kbd_report(kbds, &prev, &time);
+                    ++changes;
+                }
+                continue;
+            }
+
+            if(
+               ev->type != EV_KEY
+            || ev->code > KEY_MAX
+            || kbds->dropped[idx]
+            )
+                continue;
+
+            // value is 0 for release, 1 for press, and 2 for auto repeat
+            int byte = ev->code / 8;
+            unsigned char bit = 1 << ev->code % 8;
+            if(ev->value)
+                kbd_kmap[byte] |= bit;
+            else
+                kbd_kmap[byte] &= ~bit;
+
+            // The merged state of a key is pressed if any keyboard has it
+            unsigned char merged = 0;
+            for(size_t k = 0; k < kbds->count; ++k)
+                merged |= kbds->kbd_kmap[k].bits[byte] & bit;
+
+            if((kbds->kmap.bits[byte] & bit) != merged)
+            {
+                kbds->kmap.bits[byte] ^= bit;
+                ++changes;
+                if(kbds->on_key)
+                    kbds->on_key(kbds->on_key_ctx, ev->code, merged != 0, &time);
+            }
+            else if(ev->value == 2 && kbds->on_key)
+                kbds->on_key(kbds->on_key_ctx, ev->code, 2, &time);
+        }
+    }
+
+    return changes;
+}
+
+int console_s_linux_kbd_pump(console_kbd_set *kbds, int timeout)
+{
+    if(kbds->epoll < 0)
+        return -1;
+
+    struct epoll_event evs[CONSOLE_KBD_EPOLL_USER + 1];
+    long long waited = CONSOLE_S_STAT_NOW();
+    int evcount = epoll_wait(kbds->epoll, evs, CONSOLE_KBD_EPOLL_USER + 1, timeout);
+    // The event thread blocks here all the time, only the time
+    // the program itself spent waiting is counted
+    if(timeout && kbds == &s_cstate.kbd)
+        CONSOLE_S_STAT(wait_us, CONSOLE_S_STAT_NOW() - waited);
+
+    if(evcount < 0)
+        return errno == EINTR ? 0 : -1;
+
+    int changes = 0;
+    int hotplug = 0;
+    for(int i = 0; i < evcount; ++i)
+    {
+        if(evs[i].data.u32 == KBD_EPOLL_INOTIFY)
+            hotplug = 1;
+        else if(evs[i].data.u32 < kbds->count)
+            changes += s_console_linux_kbd_read(kbds, evs[i].data.u32);
+    }
+
+    // Hotplugs are handled last, as a rescan changes the keyboard indices
+    if(hotplug && console_s_linux_kbd_hotplug(kbds))
+        ++changes;
+
+    return changes;
+}
+#endif
@@ -5,6 +5,7 @@ int console_key_state(int key)
     // The code size difference between Linux and Windows
     // for this function is almost funny
 #if defined(_WIN32)
+    CONSOLE_S_STAT(key_ioctls, 1);
     return GetKeyState(key) & 0x8000;
 #elif defined(__linux)
     /*
@@ -15,148 +16,365 @@ int console_key_state(int key)
      * manually check if any keyboard has `key` pressed.
      * The steps to implement this are:
      *      - Detect connected keyboards
-     *        This can be done by searching the directory
-     *        /dev/input/by-path for keyboard control files
-     *        ending with `kbd`
-     *      - For each keyboard detected, check if `key` is pressed
+     *        This is done once by console_init, which keeps
+     *        all keyboards open, and then only again when
+     *        a keyboard is plugged or unplugged
+     *      - For each keyboard, check if `key` is pressed
      *      - If no keyboard reports `key` being pressed, then we return 0
+     *
+     * In CONSOLE_KEY_MODE_EVENT, none of this is done here, the key events
+     * read by console_key_update already keep a bitmap of all keys
+     *
+     * When no keyboard could be read, the keys typed in the terminal
+     * are used instead, see console_tty.c
      */
+    if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+    {
+        if(s_cstate.key_mode != CONSOLE_KEY_MODE_EVENT)
+            console_s_linux_tty_pump(0);
+        return CONSOLE_KEYMAP_TEST(&s_cstate.tty_kmap, key);
+    }
 
-    // Step one, iterate over all files in /dev/input/by-path/
-    DIR *evdir = opendir(DIR_DEV_INPUT_BY_PATH);
+    if(s_cstate.key_mode == CONSOLE_KEY_MODE_EVENT)
+    {
+        if(!s_cstate.kbd.dir_found)
+            return -1;
+        return CONSOLE_KEYMAP_TEST(&s_cstate.kbd.kmap, key);
+    }
 
-    if(!evdir)
+    // Step one, make sure the list of keyboards is up to date
+    console_s_linux_kbd_hotplug(&s_cstate.kbd);
+
+    if(!s_cstate.kbd.dir_found)
         return -1;
 
-    struct dirent *ent;
-    while(1)
+    for(size_t i = 0; i < s_cstate.kbd.count; ++i)
     {
-        ent = readdir(evdir);
+        // we use ioctl with EVIOCGKEY
+        // https://stackoverflow.com/a/4225290
+        console_keymap *kbd_kmap = &s_cstate.kbd.kbd_kmap[i];
+        int ioctl_res = ioctl(
+            s_cstate.kbd.fds[i],
+            EVIOCGKEY(sizeof(kbd_kmap->bits)),
+            kbd_kmap->bits
+        );
+        CONSOLE_S_STAT(key_ioctls, 1);
 
-        if(!ent) // We ran out of keyboards to check and none was pressed
+        if(ioctl_res < 0)
         {
-            closedir(evdir);
-            return 0;
+            // if we had an error, the keyboard was probably unplugged
+            // the inotify watch will tell us about it soon, so we
+            // just go to the next keyboard
+            continue;
         }
 
-        // For each file in /dev/input/by-path, we check
-        //   - it is either a link or char device
-        //   - it ends with `kbd`
-        //   - if it is a link, check that it is pointing to a char device
+        if(CONSOLE_KEYMAP_TEST(kbd_kmap, key))
+            return 1;
+    }
 
-        // check that file is link or char device
-        if(ent->d_type != DT_LNK && ent->d_type != DT_CHR)
-            continue;
+    // We ran out of keyboards to check and none was pressed
+    return 0;
+#endif
+}
 
-        // check that filename ends with `kbd`
-        size_t ent_name_len = strlen(ent->d_name);
-        if(
-           ent_name_len < 3
-        || strcmp(ent->d_name + ent_name_len - 3, "kbd")
-        )
-            continue;
+int console_key_mode(int mode)
+{
+    int prev_mode = s_cstate.key_mode;
+    if(mode == prev_mode)
+        return prev_mode;
 
-        // open the file, we use Linux system call directly
-        // This is mostly because it is painful to create
-        // the string for the absolute path by hand
-        // instead we use the syscall openat, which
-        // takes a directory file number and the relative path
-        // of the file to that directory.
+    s_cstate.key_mode = mode;
+#if defined(__linux)
+    if(
+       mode == CONSOLE_KEY_MODE_EVENT
+    && s_cstate.input_backend == CONSOLE_INPUT_NATIVE
+    )
+    {
+        // The events that piled up while we were not reading
+        // them are stale, they are dropped, and the real
+        // state of the keyboards is loaded instead
+        console_s_linux_kbd_pump(&s_cstate.kbd, 0);
+        console_s_linux_kbd_sync(&s_cstate.kbd);
+    }
+#endif
+    return prev_mode;
+}
 
-        // the file is open in read only mode
-        int fkbd = openat(dirfd(evdir), ent->d_name, O_RDONLY);
+int console_key_update()
+{
+#if defined(_WIN32)
+    // GetKeyState is already a memory lookup in Windows
+    return 0;
+#elif defined(__linux)
+    if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+        return console_s_linux_tty_pump(0);
+    return console_s_linux_kbd_pump(&s_cstate.kbd, 0);
+#endif
+}
 
-        if(fkbd < 0)
-        {
-            // if there was an error opening the file
-            // simply skip to the next file
-            continue;
-        }
+int console_input_backend()
+{
+    return s_cstate.input_backend;
+}
 
-        // if the file is a link
-        if(ent->d_type == DT_LNK)
-        {
-            // check that file is a link to a char dev
-            struct stat file_info;
-            fstat(fkbd, &file_info);
-
-            // fstat returns information about the file
-            // if the file was a link, it will resolve the link
-            // before and return information about the real file
-
-            if((file_info.st_mode & S_IFMT) != S_IFCHR)
-            {
-                // this file is not a character device file,
-                // as a result, we close and skip to the next device
-                close(fkbd);
-                continue;
-            }
-        }
 
-        // Here we are sure that the file
-        // is a char dev that is *probably* a keyboard
+/* Number of 64 bit words in a console_keymap */
+#define KEYMAP_WORDS (sizeof(console_keymap) / sizeof(uint64_t))
 
-        // we use ioctl with EVIOCGKEY
-        // https://stackoverflow.com/a/4225290
-        int ioctl_res =
-            ioctl(fkbd, EVIOCGKEY(sizeof(s_cstate.kmap)), s_cstate.kmap);
+/*
+ * Keymaps are processed a word at a time
+ * memcpy is used to load and store words, as the bitmaps are
+ * only guaranteed to be byte aligned. The compiler turns these into
+ * plain loads and stores, and vectorizes the loops
+ */
+void console_s_keymap_or(console_keymap *dst, console_keymap const *src)
+{
+    for(size_t i = 0; i < KEYMAP_WORDS; ++i)
+    {
+        uint64_t d, s;
+        memcpy(&d, dst->bits + i * 8, 8);
+        memcpy(&s, src->bits + i * 8, 8);
+        d |= s;
+        memcpy(dst->bits + i * 8, &d, 8);
+    }
+}
 
-        // close device
-        close(fkbd);
+int console_key_snapshot(
+    console_keymap *state,
+    console_keymap *pressed,
+    console_keymap *released
+)
+{
+    console_keymap cur;
+    memset(&cur, 0, sizeof(cur));
 
-        if(ioctl_res < 0)
+#if defined(_WIN32)
+    for(int key = 0; key < CONSOLE_KEY_COUNT; ++key)
+        if(GetKeyState(key) & 0x8000)
+            cur.bits[key / 8] |= 1 << key % 8;
+    CONSOLE_S_STAT(key_ioctls, CONSOLE_KEY_COUNT);
+#elif defined(__linux)
+    if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+    {
+        if(console_s_linux_tty_pump(0) < 0)
+            return -1;
+    }
+    else if(s_cstate.key_mode == CONSOLE_KEY_MODE_EVENT)
+    {
+        // The merged bitmap is kept up to date by key events
+        // we only need to read the events that are pending
+        if(console_s_linux_kbd_pump(&s_cstate.kbd, 0) < 0)
+            return -1;
+    }
+    else
+    {
+        // Each keyboard is asked for its state once
+        // and all of them are merged at once
+        console_s_linux_kbd_hotplug(&s_cstate.kbd);
+
+        memset(&s_cstate.kbd.kmap, 0, sizeof(s_cstate.kbd.kmap));
+        CONSOLE_S_STAT(key_ioctls, s_cstate.kbd.count);
+        for(size_t i = 0; i < s_cstate.kbd.count; ++i)
         {
-            // if we had an error, it probably means that this device was not
-            // a keyboard after all, we lost some time opening
-            // and ioctl-ing it, but it's not a problem just go
-            // to next device
-            continue;
+            console_keymap *kbd_kmap = &s_cstate.kbd.kbd_kmap[i];
+            if(
+               ioctl(
+                   s_cstate.kbd.fds[i],
+                   EVIOCGKEY(sizeof(kbd_kmap->bits)),
+                   kbd_kmap->bits
+               ) < 0
+            )
+                continue;
+            console_s_keymap_or(&s_cstate.kbd.kmap, kbd_kmap);
         }
+    }
 
-        if(s_cstate.kmap[key/8] & (1 << key % 8))
-            return 1;
+    if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+        cur = s_cstate.tty_kmap;
+    else if(!s_cstate.kbd.dir_found)
+        return -1;
+    else
+        cur = s_cstate.kbd.kmap;
+#endif
+
+    // Edges since the previous snapshot
+    //   pressed  = cur & ~prev
+    //   released = prev & ~cur
+    for(size_t i = 0; i < KEYMAP_WORDS; ++i)
+    {
+        uint64_t c, p;
+        memcpy(&c, cur.bits + i * 8, 8);
+        memcpy(&p, s_cstate.key_snapshot.bits + i * 8, 8);
+
+        uint64_t down = c & ~p;
+        uint64_t up = p & ~c;
+
+        if(pressed)
+            memcpy(pressed->bits + i * 8, &down, 8);
+        if(released)
+            memcpy(released->bits + i * 8, &up, 8);
     }
+
+    s_cstate.key_snapshot = cur;
+    if(state)
+        *state = cur;
+
+    return 0;
+}
+
+/*
+ * The wait functions do not poll the key states in a loop,
+ * instead they block until a key event arrives, and only then check
+ * the keys again. On Linux, this is a blocking epoll_wait on all keyboards
+ * On Windows, GetKeyState has no event to wait on, so we sleep between checks
+ */
+
+/* Monotonic time in millis, only used to compute timeouts */
+static long long s_console_time_ms()
+{
+#if defined(_WIN32)
+    return GetTickCount64();
+#elif defined(__linux)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 #endif
 }
 
+/* Same as console_key_state, but never asks the keyboards */
+static int s_console_key_down(int key)
+{
+#if defined(_WIN32)
+    return (GetKeyState(key) & 0x8000) != 0;
+#elif defined(__linux)
+    if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+        return CONSOLE_KEYMAP_TEST(&s_cstate.tty_kmap, key);
+    return CONSOLE_KEYMAP_TEST(&s_cstate.kbd.kmap, key);
+#endif
+}
 
-void console_wait_click(int key)
+// Prepares the key states that s_console_key_down reads
+// Non zero return code means error
+static int s_console_wait_prologue()
 {
-    // if key was pressed before call, wait for it to be released first
-    if(console_key_state(key))
-        while(console_key_state(key));
+    // Whatever was drawn should be visible while we wait
+    console_flush();
 
-    /* Wait for the key to be pressed */
-    while(!console_key_state(key));
+#if defined(__linux)
+    // Keys typed ahead are still in the terminal input, they are
+    // presses made after the call, not keys that were already down
+    if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+        return 0;
 
-    /* Wait for the key that was pressed to be released */
-    while(console_key_state(key));
+    if(s_cstate.kbd.epoll < 0)
+        return -1;
+
+    // Drop the events that piled up before the wait
+    // and start from the real state of the keyboards
+    console_s_linux_kbd_pump(&s_cstate.kbd, 0);
+    console_s_linux_kbd_sync(&s_cstate.kbd);
+#endif
+    return 0;
 }
 
-int console_wait_clicks(int *keys, size_t kcount)
+/*
+ * Blocks until key events arrive, or until deadline(0 for no deadline)
+ * Returns 0 when the keys should be checked again, 1 on timeout, -1 on error
+ */
+static int s_console_wait_event(long long deadline)
+{
+    int timeout = -1;
+    if(deadline)
+    {
+        long long left = deadline - s_console_time_ms();
+        if(left <= 0)
+            return 1;
+        timeout = left > INT_MAX ? INT_MAX : (int) left;
+    }
+#if defined(_WIN32)
+    long long waited = CONSOLE_S_STAT_NOW();
+    Sleep(timeout < 0 || timeout > 10 ? 10 : timeout);
+    CONSOLE_S_STAT(wait_us, CONSOLE_S_STAT_NOW() - waited);
+    return 0;
+#elif defined(__linux)
+    if(s_cstate.input_backend == CONSOLE_INPUT_TTY)
+        return console_s_linux_tty_pump(timeout) < 0 ? -1 : 0;
+    return console_s_linux_kbd_pump(&s_cstate.kbd, timeout) < 0 ? -1 : 0;
+#endif
+}
+
+/*
+ * Waits for one of keys to be pressed then released, the key is put in *key
+ * Returns 0 on success, 1 on timeout and -1 on error
+ */
+static int s_console_wait_clicks(
+    int *keys, size_t kcount, size_t timeout, int *key
+)
 {
-   int key = -1;
+    if(!kcount || s_console_wait_prologue())
+        return -1;
 
-   /* If any of keys was pressed before the function call
-      Wait for it to be released first */
+    long long deadline = timeout ? s_console_time_ms() + timeout : 0;
+    int status;
+    *key = -1;
+
+    /* If any of keys was pressed before the function call
+       Wait for it to be released first */
     for(size_t i = 0; i < kcount; ++i)
-        if(console_key_state(keys[i]))
-            while(console_key_state(keys[i]));
+        while(s_console_key_down(keys[i]))
+            if((status = s_console_wait_event(deadline)))
+                return status;
 
     /* Wait for any of keys to be pressed */
-    while(key == -1)
+    while(1)
     {
-        for(size_t i = 0; i < kcount; ++i)
-            if(console_key_state(keys[i]))
-            {
+        for(size_t i = 0; i < kcount && *key == -1; ++i)
+            if(s_console_key_down(keys[i]))
                 /* Found a key that was pressed */
-                key = keys[i];
-                break;
-            }
+                *key = keys[i];
+
+        if(*key != -1)
+            break;
+
+        if((status = s_console_wait_event(deadline)))
+            return status;
     }
 
     /* Wait for the key that was pressed to be released */
-    while(!console_key_state(key));
+    while(s_console_key_down(*key))
+        if((status = s_console_wait_event(deadline)))
+            return status;
+
+#if defined(__linux)
+    // The terminal also received the keys of the click, they are
+    // thrown away so that they do not end up in the next text input
+    // The terminal key backend already took them
+    if(s_cstate.input_backend == CONSOLE_INPUT_NATIVE)
+        console_s_linux_tty_discard();
+#endif
+    return 0;
+}
 
-   return key;
+int console_wait_click_timeout(int key, size_t timeout)
+{
+    int clicked;
+    return s_console_wait_clicks(&key, 1, timeout, &clicked);
+}
+
+int console_wait_clicks_timeout(int *keys, size_t kcount, size_t timeout)
+{
+    int key;
+    if(s_console_wait_clicks(keys, kcount, timeout, &key))
+        return -1;
+    return key;
+}
+
+void console_wait_click(int key)
+{
+    console_wait_click_timeout(key, 0);
+}
+
+int console_wait_clicks(int *keys, size_t kcount)
+{
+    return console_wait_clicks_timeout(keys, kcount, 0);
 }
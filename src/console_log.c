@@ -0,0 +1,300 @@
+#include "console_api.common.h"
+
+/*
+ * Log panes, a region of the cell screen that shows the last lines of a
+ * log, and can be scrolled back.
+ *
+ * The text of the lines is kept in one arena, used as a ring: each line is
+ * written after the previous one, followed by a null byte, and the oldest
+ * lines are dropped when the arena or the table of lines is full. A line is
+ * never split across the end of the arena, the bytes left at its end are
+ * skipped instead. Lines are numbered from the first one appended, line n
+ * is lines[n % max_lines], so finding a line takes no search.
+ *
+ * Appending copies the line and drops as many old lines as it needs,
+ * under a lock, so any thread can append. Drawing only reads the lines
+ * that are visible, it puts them on the cell screen each time, whatever
+ * happened to the screen since(console_screen_clear...), present then
+ * only writes the cells that changed.
+ */
+
+struct LOG_LINE
+{
+    size_t off; /* Offset of the text in the arena */
+    uint32_t len; /* Length of the text, without the null byte */
+};
+
+struct CONSOLE_LOG
+{
+#if defined(_WIN32)
+    CRITICAL_SECTION lock;
+#elif defined(__linux)
+    pthread_mutex_t lock;
+#endif
+
+    int x, y, w, h; /* Region of the cell screen */
+
+    char *arena;
+    size_t arena_size;
+    size_t head; /* Where the next line is written in the arena */
+
+    struct LOG_LINE *lines;
+    size_t max_lines;
+    size_t first; /* Number of the oldest line kept */
+    size_t count; /* Number of lines kept */
+
+    size_t scroll; /* Lines between the last visible line and the last line */
+};
+
+static void s_console_log_lock(console_log *log)
+{
+#if defined(_WIN32)
+    EnterCriticalSection(&log->lock);
+#elif defined(__linux)
+    pthread_mutex_lock(&log->lock);
+#endif
+}
+
+static void s_console_log_unlock(console_log *log)
+{
+#if defined(_WIN32)
+    LeaveCriticalSection(&log->lock);
+#elif defined(__linux)
+    pthread_mutex_unlock(&log->lock);
+#endif
+}
+
+console_log *console_log_create(
+    int x, int y,
+    int width, int height,
+    size_t max_lines,
+    size_t arena_size
+)
+{
+    // A line needs at least its null byte
+    if(width <= 0 || height <= 0 || !max_lines || arena_size < 2)
+        return 0;
+
+    console_log *log = calloc(1, sizeof(console_log));
+    if(!log)
+        return 0;
+
+    log->arena = malloc(arena_size);
+    log->lines = malloc(max_lines * sizeof(struct LOG_LINE));
+    if(!log->arena || !log->lines)
+    {
+        free(log->arena);
+        free(log->lines);
+        free(log);
+        return 0;
+    }
+
+#if defined(_WIN32)
+    InitializeCriticalSection(&log->lock);
+#elif defined(__linux)
+    pthread_mutex_init(&log->lock, 0);
+#endif
+
+    log->x = x;
+    log->y = y;
+    log->w = width;
+    log->h = height;
+    log->arena_size = arena_size;
+    log->max_lines = max_lines;
+    return log;
+}
+
+void console_log_free(console_log *log)
+{
+    if(!log)
+        return;
+
+#if defined(_WIN32)
+    DeleteCriticalSection(&log->lock);
+#elif defined(__linux)
+    pthread_mutex_destroy(&log->lock);
+#endif
+    free(log->arena);
+    free(log->lines);
+    free(log);
+}
+
+/* Lines the view can be scrolled back by */
+static size_t s_console_log_max_scroll(console_log const *log)
+{
+    return log->count > (size_t) log->h ? log->count - log->h : 0;
+}
+
+void console_log_place(console_log *log, int x, int y, int width, int height)
+{
+    if(width <= 0 || height <= 0)
+        return;
+
+    s_console_log_lock(log);
+    log->x = x;
+    log->y = y;
+    log->w = width;
+    log->h = height;
+    if(log->scroll > s_console_log_max_scroll(log))
+        log->scroll = s_console_log_max_scroll(log);
+    s_console_log_unlock(log);
+}
+
+static void s_console_log_drop_oldest(console_log *log)
+{
+    ++log->first;
+    --log->count;
+    // The arena is empty, the next line can start at its beginning
+    if(!log->count)
+        log->head = 0;
+}
+
+/* Returns where a line of size bytes can be written, dropping old lines */
+static size_t s_console_log_make_room(console_log *log, size_t size)
+{
+    if(log->count == log->max_lines)
+        s_console_log_drop_oldest(log);
+
+    while(log->count)
+    {
+        // The text of the lines goes from tail to head, after the
+        // end of the arena it goes on from its start(head <= tail)
+        size_t tail = log->lines[log->first % log->max_lines].off;
+        if(log->head > tail)
+        {
+            if(size <= log->arena_size - log->head)
+                return log->head;
+            if(size <= tail)
+                return 0;
+        }
+        else if(size <= tail - log->head)
+            return log->head;
+        s_console_log_drop_oldest(log);
+    }
+    return 0;
+}
+
+/* Appends one line, the lock is held */
+static void s_console_log_line(console_log *log, char const *text, size_t len)
+{
+    // A line longer than the arena is cut, at the
+    // start of a UTF-8 sequence, to leave room for its null byte
+    if(len > log->arena_size - 1)
+    {
+        len = log->arena_size - 1;
+        while(len && (text[len] & 0xC0) == 0x80)
+            --len;
+    }
+    if(len > UINT32_MAX)
+        len = UINT32_MAX;
+
+    size_t off = s_console_log_make_room(log, len + 1);
+    memcpy(log->arena + off, text, len);
+    log->arena[off + len] = 0;
+    log->head = off + len + 1;
+
+    size_t idx = (log->first + log->count) % log->max_lines;
+    struct LOG_LINE *line = &log->lines[idx];
+    line->off = off;
+    line->len = len;
+    ++log->count;
+
+    // A view that was scrolled back stays on the same lines
+    if(log->scroll)
+    {
+        ++log->scroll;
+        if(log->scroll > s_console_log_max_scroll(log))
+            log->scroll = s_console_log_max_scroll(log);
+    }
+}
+
+void console_log_append(console_log *log, char const *text, size_t len)
+{
+    s_console_log_lock(log);
+    while(1)
+    {
+        char const *nl = memchr(text, '\n', len);
+        size_t line_len = nl ? (size_t) (nl - text) : len;
+        s_console_log_line(log, text, line_len);
+        if(!nl)
+            break;
+        text += line_len + 1;
+        len -= line_len + 1;
+    }
+    s_console_log_unlock(log);
+}
+
+int console_log_key(console_log *log, int key)
+{
+    s_console_log_lock(log);
+    size_t max = s_console_log_max_scroll(log);
+    size_t page = log->h > 1 ? log->h - 1 : 1;
+    size_t scroll = log->scroll;
+    int used = 1;
+    switch(key)
+    {
+        case CONSOLE_KEY_UP:
+            scroll = scroll < max ? scroll + 1 : max;
+            break;
+        case CONSOLE_KEY_DOWN:
+            scroll = scroll ? scroll - 1 : 0;
+            break;
+        case CONSOLE_KEY_PAGEUP:
+            scroll = max - scroll > page ? scroll + page : max;
+            break;
+        case CONSOLE_KEY_PAGEDOWN:
+            scroll = scroll > page ? scroll - page : 0;
+            break;
+        case CONSOLE_KEY_HOME:
+            scroll = max;
+            break;
+        case CONSOLE_KEY_END:
+            scroll = 0;
+            break;
+        default:
+            used = 0;
+            break;
+    }
+    log->scroll = scroll;
+    s_console_log_unlock(log);
+    return used;
+}
+
+void console_log_draw(console_log *log)
+{
+    s_console_log_lock(log);
+
+    // The last lines, up to the scroll, fill the region from the top
+    size_t end = log->first + log->count - log->scroll;
+    size_t shown = log->count - log->scroll;
+    if(shown > (size_t) log->h)
+        shown = log->h;
+    size_t top = end - shown;
+
+    for(int row = 0; row < log->h; ++row)
+    {
+        int cols = 0;
+        if((size_t) row < shown)
+        {
+            struct LOG_LINE const *line =
+                &log->lines[(top + row) % log->max_lines];
+            char const *text = log->arena + line->off;
+            size_t width;
+            size_t len = console_str_fit(text, line->len, log->w, &width);
+
+            // The line ends with a null byte, a UTF-8
+            // sequence cut by its end is not read past it
+            size_t i = 0;
+            while(i < len)
+            {
+                uint32_t cp;
+                i += console_s_dec_utf8(text + i, &cp);
+                console_screen_put(log->x + cols, log->y + row, cp, 0);
+                cols += console_char_width(cp);
+            }
+        }
+        for(; cols < log->w; ++cols)
+            console_screen_put(log->x + cols, log->y + row, ' ', 0);
+    }
+    s_console_log_unlock(log);
+}
@@ -1,73 +1,433 @@
 #include "console_api.common.h"
 
+/*
+ * The menu only ever draws the entries that are visible in the terminal
+ * (the view), never the whole list. The view scrolls to keep the
+ * selected entry visible. Moving the selection inside the view only
+ * redraws the entry that lost the selection and the one that gained it,
+ * scrolling redraws the view. Either way, the cost of a step depends on
+ * the height of the terminal, not on the number of entries.
+ *
+ * Typing filters the menu, only the entries whose name or detail contain
+ * what was typed are listed. Backspace removes the last character typed
+ * and Escape removes them all.
+ * See console_menu_index.c for how the filtering is done.
+ *
+ * The filter is typed fast, the next key is often pressed before the
+ * previous one is released, so key states would lose characters. The keys
+ * are read in the order they were typed instead, with the text they type:
+ * from the terminal on Linux, and from the console input on Windows.
+ * A menu that cannot be filtered only needs clicks of its navigation keys.
+ */
+
+/* State of a menu while it is displayed */
+struct MENU_VIEW
+{
+    menu_ent *entries;
+    size_t entries_count;
+
+    /* Entries listed, they are the matches of the filter if there is one */
+    size_t *items; /* Indices of the entries, null means all entries */
+    size_t items_count;
+
+    int term_w; /* Width of the terminal, 0 if unknown */
+    size_t prompt_rows; /* Rows taken by the prompt */
+    size_t top; /* Index of the first visible item */
+    size_t height; /* Number of items that fit in the view */
+};
+
+/* Keys used to navigate the menu */
+static int const s_console_menu_nav_keys[] =
+{
+    CONSOLE_KEY_DOWN, CONSOLE_KEY_UP, CONSOLE_KEY_ENTER,
+    CONSOLE_KEY_PAGEDOWN, CONSOLE_KEY_PAGEUP,
+    CONSOLE_KEY_HOME, CONSOLE_KEY_END,
+    CONSOLE_KEY_BACKSPACE, CONSOLE_KEY_ESCAPE
+};
+
+#define MENU_NAV_KEYS_COUNT \
+    (sizeof(s_console_menu_nav_keys) / sizeof(*s_console_menu_nav_keys))
+
+/*
+ * Waits for the next key typed, puts it in *key(0 if it is not one of
+ * CONSOLE_KEY_*) and the UTF-8 encoded text it types, if any, in text
+ * Returns 0 on success and -1 on error
+ */
+static int s_console_menu_read_key(int *key, char *text, size_t *text_len)
+{
+    // Whatever was drawn should be visible while we wait
+    console_flush();
+
+#if defined(_WIN32)
+    while(1)
+    {
+        INPUT_RECORD rec;
+        DWORD rec_count;
+        if(!ReadConsoleInputW(s_cstate.handle_stdin, &rec, 1, &rec_count))
+            return -1;
+        if(rec.EventType != KEY_EVENT || !rec.Event.KeyEvent.bKeyDown)
+            continue;
+
+        // Characters outside of the BMP come as two surrogates,
+        // they are not typed in the filter
+        WCHAR wc = rec.Event.KeyEvent.uChar.UnicodeChar;
+        *key = rec.Event.KeyEvent.wVirtualKeyCode & 0xFF;
+        *text_len = 0;
+        if(wc >= 0x20 && wc != 0x7F && (wc < 0xD800 || wc > 0xDFFF))
+            *text_len = console_s_enc_utf8(text, wc);
+        return 0;
+    }
+#elif defined(__linux)
+    while(1)
+    {
+        console_tty_key tk;
+        if(console_s_linux_tty_key(&tk, 0) <= 0)
+            return -1;
+
+        // Keys typed before the kitty protocol was turned off
+        // can still be releases
+        if(tk.type == CONSOLE_EVENT_RELEASE || tk.reply)
+            continue;
+
+        *key = tk.key;
+        *text_len = tk.text_len;
+        memcpy(text, tk.text, tk.text_len);
+        return 0;
+    }
+#endif
+}
+
+/* Undoes what console_menu set up to filter the entries */
+static void s_console_menu_end(int filterable, console_menu_index *index)
+{
+    if(!filterable)
+        return;
+    console_s_menu_index_free(index);
+#if defined(__linux)
+    console_s_linux_tty_kitty(1);
+#endif
+}
+
+/* Number of terminal rows str takes, when the terminal is width wide */
+static size_t s_console_menu_text_rows(char const *str, int width)
+{
+    size_t rows = 0;
+    while(1)
+    {
+        size_t line_len = strcspn(str, "\n");
+        size_t line_cols = console_str_width(str, line_len);
+        // Long lines wrap on the next rows
+        size_t line_rows = width > 0 ? (line_cols + width - 1) / width : 1;
+        rows += line_rows ? line_rows : 1;
+
+        if(!str[line_len])
+            return rows;
+        str += line_len + 1;
+    }
+}
+
+/* Moves the cursor to the start of row(origin is 0) */
+static void s_console_menu_goto_row(size_t row)
+{
+    console_s_cursor_goto(0, row, 0);
+}
+
+/*
+ * Writes as much of str as fits in *cols, and removes what was written
+ * from *cols. Entries are cut instead of wrapping, so that each takes
+ * exactly one row. *cols < 0 means there is no limit
+ */
+static void s_console_menu_text(char const *str, int *cols)
+{
+    size_t len = strlen(str);
+    if(*cols < 0)
+    {
+        console_s_out_write(str, len);
+        return;
+    }
+
+    // Wide characters take two columns, combining marks none
+    size_t width;
+    len = console_str_fit(str, len, *cols, &width);
+    console_s_out_write(str, len);
+    *cols -= width;
+}
+
+/* Index in entries of the item pos */
+static size_t s_console_menu_item(struct MENU_VIEW *view, size_t pos)
+{
+    return view->items ? view->items[pos] : pos;
+}
+
+/* Draws one item at the cursor, without the line break */
+static void s_console_menu_entry(
+    struct MENU_VIEW *view,
+    size_t pos,
+    int selected
+)
+{
+    menu_ent *entry = &view->entries[s_console_menu_item(view, pos)];
+    int cols = view->term_w > 0 ? view->term_w - 1 : -1;
+
+    /* The item currently selected is displayed differently */
+    if(entry->disabled)
+        console_dim(1);
+    if(selected)
+    {
+        console_color_switch(1);
+        s_console_menu_text(" [ ", &cols);
+        s_console_menu_text(entry->ent_name, &cols);
+        s_console_menu_text(" ] ", &cols);
+        s_console_menu_text(entry->ent_detail, &cols);
+        console_color_switch(0);
+    }
+    else
+    {
+        s_console_menu_text("   ", &cols);
+        s_console_menu_text(entry->ent_name, &cols);
+    }
+    console_dim(0);
+}
+
+/* Redraws the item pos over what was there before */
+static void s_console_menu_redraw_entry(
+    struct MENU_VIEW *view,
+    size_t pos,
+    int selected
+)
+{
+    s_console_menu_goto_row(view->prompt_rows + pos - view->top);
+    // Escape code meaning
+    // \e[2K clears the whole line the cursor is on
+    CONSOLE_WRITE_LITERAL("\e[2K");
+    CONSOLE_S_STAT(seq_erase, 1);
+    s_console_menu_entry(view, pos, selected);
+}
+
+/* Redraws all visible items */
+static void s_console_menu_redraw_view(struct MENU_VIEW *view, size_t sel_pos)
+{
+    for(size_t row = 0; row < view->height; ++row)
+    {
+        size_t pos = view->top + row;
+        if(pos < view->items_count)
+            s_console_menu_redraw_entry(view, pos, pos == sel_pos);
+        else
+        {
+            s_console_menu_goto_row(view->prompt_rows + row);
+            CONSOLE_WRITE_LITERAL("\e[2K");
+            CONSOLE_S_STAT(seq_erase, 1);
+        }
+    }
+}
+
+/* Redraws the row after the view, that shows the filter */
+static void s_console_menu_redraw_filter(
+    struct MENU_VIEW *view,
+    console_menu_index const *index
+)
+{
+    s_console_menu_goto_row(view->prompt_rows + view->height);
+    CONSOLE_WRITE_LITERAL("\e[2K");
+    CONSOLE_S_STAT(seq_erase, 1);
+    if(!index->query_len)
+        return;
+
+    int cols = view->term_w > 0 ? view->term_w - 1 : -1;
+    char count[24];
+    count[console_s_enc_uint(count, view->items_count)] = 0;
+
+    console_dim(1);
+    s_console_menu_text("Filter: ", &cols);
+    console_dim(0);
+    s_console_menu_text(index->query, &cols);
+    console_dim(1);
+    s_console_menu_text(" (", &cols);
+    s_console_menu_text(count, &cols);
+    s_console_menu_text(")", &cols);
+    console_dim(0);
+}
+
 size_t console_menu(char *prompt, menu_ent *entries, size_t entries_count)
 {
-    /* Displaying the menu is a loop of:
+    /* Displaying the menu is done by:
         - Clearing display
         - Displaying prompt
-        - Drawing menu
-        - waiting & acting on user input */
+        - Drawing the visible entries
+       Then a loop of:
+        - waiting & acting on user input
+        - Redrawing only what changed */
     if(!entries_count)
         return 0;
     console_style_reset();
 
-    size_t sel_idx = 0;
+    // Without an index(not enough memory) the menu cannot be filtered
+    console_menu_index index;
+    int filterable = !console_s_menu_index_build(&index, entries, entries_count);
+#if defined(__linux)
+    // Keys have to be sent as text while the filter is typed
+    if(filterable)
+        console_s_linux_tty_kitty(0);
+#endif
+
+    struct MENU_VIEW view;
+    view.entries = entries;
+    view.entries_count = entries_count;
+    view.items = filterable ? index.matches : 0;
+    view.items_count = entries_count;
+    view.top = 0;
+
+    int term_h = 0;
+    view.term_w = 0;
+    console_s_term_size(&view.term_w, &term_h);
+
+    // If the size of the terminal is not known, the whole menu is the view
+    view.prompt_rows = s_console_menu_text_rows(prompt, view.term_w);
+    view.height = entries_count;
+    if(term_h > 0)
+    {
+        // The last row is kept for the filter and the cursor
+        view.height = term_h > (int) view.prompt_rows + 1
+                    ? term_h - view.prompt_rows - 1
+                    : 1;
+        if(view.height > entries_count)
+            view.height = entries_count;
+    }
+
+    size_t sel_pos = 0;
+    size_t prev_pos = 0;
+    size_t prev_top = 0;
+    int filter_changed = 0;
+
+    console_clear();
+    console_bold(1);
+    console_color_foreground(242, 140, 40);
+    console_s_out_str(prompt);
+    console_style_reset();
+    s_console_menu_redraw_view(&view, sel_pos);
 
     while(1)
     {
-        console_clear();
+        if(filter_changed)
+        {
+            s_console_menu_redraw_view(&view, sel_pos);
+            s_console_menu_redraw_filter(&view, &index);
+        }
+        else if(view.top != prev_top)
+            s_console_menu_redraw_view(&view, sel_pos);
+        else if(prev_pos != sel_pos)
+        {
+            // Only the item that lost the selection and
+            // the one that gained it change
+            s_console_menu_redraw_entry(&view, prev_pos, 0);
+            s_console_menu_redraw_entry(&view, sel_pos, 1);
+        }
+        // Leave the cursor after the menu
+        if(!filter_changed)
+            s_console_menu_goto_row(view.prompt_rows + view.height);
 
-        console_bold(1);
-        console_color_foreground(242, 140, 40);
-        puts(prompt);
-        console_style_reset();
+        prev_pos = sel_pos;
+        prev_top = view.top;
+        filter_changed = 0;
 
-        for(size_t i = 0; i < entries_count; ++i)
+        int key;
+        char text[4];
+        size_t text_len = 0;
+        if(filterable)
         {
-            /* The item currently selected is displayed differently */
-            if(entries[i].disabled)
-                console_dim(1);
-            if(i == sel_idx)
-            {
-                console_color_switch(1);
-                printf(
-                    " [ %s ] %s\n",
-                    entries[i].ent_name,
-                    entries[i].ent_detail
-                );
-                console_color_switch(0);
-            }
-            else
-                printf("   %s\n", entries[i].ent_name);
-            console_dim(0);
+            if(s_console_menu_read_key(&key, text, &text_len))
+                key = -1;
+        }
+        else
+            key = console_wait_clicks(
+                (int *) s_console_menu_nav_keys,
+                MENU_NAV_KEYS_COUNT
+            );
+
+        if(text_len)
+        {
+            filter_changed = console_s_menu_index_push(&index, text, text_len);
+            key = 0;
         }
 
-        int wait_keys[] =
-            { CONSOLE_KEY_DOWN, CONSOLE_KEY_UP, CONSOLE_KEY_ENTER };
+        // The keys cannot be read, waiting again would not help
+        if(key < 0)
+        {
+            s_console_menu_end(filterable, &index);
+            return (size_t) -1;
+        }
 
-        int key = console_wait_clicks(wait_keys, 3);
+        // Navigation keys do nothing when no entry matches the filter
+        size_t last_pos = view.items_count ? view.items_count - 1 : 0;
 
         switch(key)
         {
             case CONSOLE_KEY_UP:
-                if(sel_idx == 0)
-                    sel_idx = entries_count - 1;
+                // if we were on the first entry, we loop back
+                if(sel_pos == 0)
+                    sel_pos = last_pos;
                 else
-                    --sel_idx;
+                    --sel_pos;
                 break;
             case CONSOLE_KEY_DOWN:
-                ++sel_idx;
+                // if we were on the last entry, we loop back
+                if(++sel_pos >= view.items_count)
+                    sel_pos = 0;
+                break;
+            case CONSOLE_KEY_PAGEUP:
+                sel_pos = sel_pos > view.height ? sel_pos - view.height : 0;
+                break;
+            case CONSOLE_KEY_PAGEDOWN:
+                sel_pos += view.height;
+                if(sel_pos > last_pos)
+                    sel_pos = last_pos;
+                break;
+            case CONSOLE_KEY_HOME:
+                sel_pos = 0;
+                break;
+            case CONSOLE_KEY_END:
+                sel_pos = last_pos;
                 break;
             case CONSOLE_KEY_ENTER:
-                if(!entries[sel_idx].disabled)
+            {
+                if(!view.items_count)
+                    break;
+                menu_ent *entry = &entries[s_console_menu_item(&view, sel_pos)];
+                if(!entry->disabled)
                 {
+                    s_console_menu_end(filterable, &index);
                     console_clear();
-                    return entries[sel_idx].ent_val;
+                    return entry->ent_val;
                 }
                 /* If this entry was disabled, just ignore ENTER */
                 break;
+            }
+            case CONSOLE_KEY_BACKSPACE:
+                if(!filterable || !index.query_len)
+                    break;
+                console_s_menu_index_pop(&index);
+                filter_changed = 1;
+                break;
+            case CONSOLE_KEY_ESCAPE:
+                if(!filterable || !index.query_len)
+                    break;
+                console_s_menu_index_clear(&index);
+                filter_changed = 1;
+                break;
+        }
+
+        if(filter_changed)
+        {
+            // The list changed, go back to its top
+            view.items_count = index.match_count;
+            sel_pos = 0;
+            view.top = 0;
         }
-        // if we were on the first/last entry, we loop back;
-        sel_idx %= entries_count;
+
+        // Scroll the view so that the selection is visible
+        if(sel_pos < view.top)
+            view.top = sel_pos;
+        else if(sel_pos >= view.top + view.height)
+            view.top = sel_pos - view.height + 1;
     }
 }
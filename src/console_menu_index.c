@@ -0,0 +1,292 @@
+#include "console_api.common.h"
+
+/*
+ * Type-ahead filtering of console_menu keeps the entries whose name or
+ * detail contains the query, ignoring case.
+ *
+ * Checking every entry each time a character is typed is too slow for
+ * menus of 100k entries, so an index is built once per menu:
+ *   - Every entry's text is stored in lower case, in one block
+ *   - Every trigram(3 consecutive bytes) of the texts is hashed to a bucket,
+ *     and each bucket lists, in order, the entries that have one of its
+ *     trigrams. The buckets are stored back to back in bucket_ents
+ * An entry can only contain the query if it has all trigrams of the query,
+ * so only the entries of the smallest bucket of the query are checked.
+ *
+ * When a character is added to the query, the entries that matched before
+ * are a superset of the new matches, so only they are checked, unless the
+ * smallest bucket is even smaller.
+ */
+
+#define MENU_INDEX_BUCKET_BITS (16)
+#define MENU_INDEX_BUCKETS (1 << MENU_INDEX_BUCKET_BITS)
+
+/* Separates name and detail, the query never contains it */
+#define MENU_INDEX_SEP '\1'
+
+static uint32_t s_console_menu_index_bucket(char const *tri)
+{
+    uint32_t t = (uint32_t) (unsigned char) tri[0] << 16
+               | (uint32_t) (unsigned char) tri[1] << 8
+               | (uint32_t) (unsigned char) tri[2];
+    // Fibonacci hashing, the top bits are the best mixed
+    return (t * 2654435761u) >> (32 - MENU_INDEX_BUCKET_BITS);
+}
+
+static size_t s_console_menu_index_lower(char *dst, char const *src)
+{
+    size_t len = 0;
+    if(!src)
+        return 0;
+    for(; src[len]; ++len)
+        dst[len] = src[len] >= 'A' && src[len] <= 'Z'
+                 ? src[len] - 'A' + 'a'
+                 : src[len];
+    return len;
+}
+
+/*
+ * Adds entry to the bucket of every trigram of text, or only counts
+ * it in bucket_count if that is not null
+ * last[b] is set to entry + 1 once entry is in bucket b, so that
+ * it is only added once
+ */
+static void s_console_menu_index_trigrams(
+    char const *text,
+    uint32_t entry,
+    uint32_t *last,
+    uint32_t *bucket_count,
+    uint32_t *bucket_fill,
+    uint32_t *bucket_ents
+)
+{
+    for(size_t i = 0; text[i] && text[i + 1] && text[i + 2]; ++i)
+    {
+        if(
+           text[i] == MENU_INDEX_SEP
+        || text[i + 1] == MENU_INDEX_SEP
+        || text[i + 2] == MENU_INDEX_SEP
+        )
+            continue;
+
+        uint32_t b = s_console_menu_index_bucket(text + i);
+        if(last[b] == entry + 1)
+            continue;
+        last[b] = entry + 1;
+
+        if(bucket_count)
+            ++bucket_count[b];
+        else
+            bucket_ents[bucket_fill[b]++] = entry;
+    }
+}
+
+int console_s_menu_index_build(
+    console_menu_index *index,
+    menu_ent const *entries,
+    size_t entries_count
+)
+{
+    memset(index, 0, sizeof(*index));
+    if(entries_count > UINT32_MAX)
+        return -1;
+
+    size_t text_len = 0;
+    for(size_t i = 0; i < entries_count; ++i)
+    {
+        text_len += entries[i].ent_name ? strlen(entries[i].ent_name) : 0;
+        text_len += entries[i].ent_detail ? strlen(entries[i].ent_detail) : 0;
+        text_len += 2;
+    }
+
+    index->entries_count = entries_count;
+    index->text = malloc(text_len);
+    index->text_off = malloc(entries_count * sizeof(size_t));
+    index->matches = malloc(entries_count * sizeof(size_t));
+    index->bucket_start = calloc(MENU_INDEX_BUCKETS + 1, sizeof(uint32_t));
+    uint32_t *last = calloc(MENU_INDEX_BUCKETS, sizeof(uint32_t));
+
+    if(
+       !index->text
+    || !index->text_off
+    || !index->matches
+    || !index->bucket_start
+    || !last
+    )
+        goto fail;
+
+    // Lower case texts
+    size_t off = 0;
+    for(size_t i = 0; i < entries_count; ++i)
+    {
+        index->text_off[i] = off;
+        off += s_console_menu_index_lower(index->text + off, entries[i].ent_name);
+        index->text[off++] = MENU_INDEX_SEP;
+        off += s_console_menu_index_lower(index->text + off, entries[i].ent_detail);
+        index->text[off++] = 0;
+    }
+
+    // First pass counts the entries of each bucket, bucket b's count is
+    // put in bucket_start[b + 1] so that summing them gives the starts
+    for(size_t i = 0; i < entries_count; ++i)
+        s_console_menu_index_trigrams(
+            index->text + index->text_off[i], i, last,
+            index->bucket_start + 1, 0, 0
+        );
+
+    size_t total = 0;
+    for(size_t b = 1; b <= MENU_INDEX_BUCKETS; ++b)
+    {
+        total += index->bucket_start[b];
+        if(total > UINT32_MAX)
+            goto fail;
+        index->bucket_start[b] = total;
+    }
+
+    index->bucket_ents = malloc((total ? total : 1) * sizeof(uint32_t));
+    if(!index->bucket_ents)
+        goto fail;
+
+    // Second pass fills the buckets, last is reset so that
+    // the same trigrams are skipped as in the first pass
+    // Entries are visited in order, so buckets are sorted
+    memset(last, 0, MENU_INDEX_BUCKETS * sizeof(uint32_t));
+    uint32_t *fill = malloc(MENU_INDEX_BUCKETS * sizeof(uint32_t));
+    if(!fill)
+        goto fail;
+    memcpy(fill, index->bucket_start, MENU_INDEX_BUCKETS * sizeof(uint32_t));
+
+    for(size_t i = 0; i < entries_count; ++i)
+        s_console_menu_index_trigrams(
+            index->text + index->text_off[i], i, last,
+            0, fill, index->bucket_ents
+        );
+
+    free(fill);
+    free(last);
+    console_s_menu_index_clear(index);
+    return 0;
+
+fail:
+    free(last);
+    console_s_menu_index_free(index);
+    return -1;
+}
+
+void console_s_menu_index_free(console_menu_index *index)
+{
+    free(index->text);
+    free(index->text_off);
+    free(index->bucket_start);
+    free(index->bucket_ents);
+    free(index->matches);
+    memset(index, 0, sizeof(*index));
+}
+
+/*
+ * Recomputes matches for the current query
+ * If refine is set, matches holds the matches of a prefix of the query
+ */
+static void s_console_menu_index_filter(console_menu_index *index, int refine)
+{
+    char const *query = index->query;
+    size_t qlen = index->query_len;
+
+    if(!qlen)
+    {
+        for(size_t i = 0; i < index->entries_count; ++i)
+            index->matches[i] = i;
+        index->match_count = index->entries_count;
+        return;
+    }
+
+    // Find the smallest bucket of the trigrams of the query
+    uint32_t const *bucket = 0;
+    size_t bucket_len = 0;
+    for(size_t i = 0; i + 3 <= qlen; ++i)
+    {
+        uint32_t b = s_console_menu_index_bucket(query + i);
+        size_t len = index->bucket_start[b + 1] - index->bucket_start[b];
+        if(!bucket || len < bucket_len)
+        {
+            bucket = index->bucket_ents + index->bucket_start[b];
+            bucket_len = len;
+        }
+    }
+
+    size_t count = 0;
+    if(bucket && (!refine || bucket_len < index->match_count))
+    {
+        for(size_t i = 0; i < bucket_len; ++i)
+            if(strstr(index->text + index->text_off[bucket[i]], query))
+                index->matches[count++] = bucket[i];
+    }
+    else if(refine)
+    {
+        // Matches are filtered in place, count never gets ahead of i
+        for(size_t i = 0; i < index->match_count; ++i)
+        {
+            size_t ent = index->matches[i];
+            if(strstr(index->text + index->text_off[ent], query))
+                index->matches[count++] = ent;
+        }
+    }
+    else
+    {
+        // Queries shorter than a trigram have no bucket
+        for(size_t i = 0; i < index->entries_count; ++i)
+            if(strstr(index->text + index->text_off[i], query))
+                index->matches[count++] = i;
+    }
+
+    index->match_count = count;
+}
+
+int console_s_menu_index_push(
+    console_menu_index *index,
+    char const *text,
+    size_t len
+)
+{
+    // A character is added whole or not at all
+    if(!len || len > CONSOLE_MENU_QUERY_MAX - index->query_len)
+        return 0;
+    if(memchr(text, MENU_INDEX_SEP, len))
+        return 0;
+
+    for(size_t i = 0; i < len; ++i)
+    {
+        char c = text[i];
+        if(c >= 'A' && c <= 'Z')
+            c = c - 'A' + 'a';
+        index->query[index->query_len++] = c;
+    }
+    index->query[index->query_len] = 0;
+
+    s_console_menu_index_filter(index, 1);
+    return 1;
+}
+
+void console_s_menu_index_pop(console_menu_index *index)
+{
+    if(!index->query_len)
+        return;
+
+    // Continuation bytes of UTF-8 are 10xxxxxx
+    do
+        --index->query_len;
+    while(index->query_len
+       && (index->query[index->query_len] & 0xC0) == 0x80);
+    index->query[index->query_len] = 0;
+
+    // The previous matches are a subset of the new ones
+    // they have to be found again
+    s_console_menu_index_filter(index, 0);
+}
+
+void console_s_menu_index_clear(console_menu_index *index)
+{
+    index->query_len = 0;
+    index->query[0] = 0;
+    s_console_menu_index_filter(index, 0);
+}
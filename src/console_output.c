@@ -0,0 +1,220 @@
+#include "console_api.common.h"
+
+#if defined(__linux)
+    #include <stdio_ext.h>
+#endif
+
+/*
+ * All output of the API goes through s_cstate.obuf instead of stdout.
+ * It is only written to the terminal by console_flush, which the API
+ * calls itself before it blocks for user input, or when the buffer is full.
+ * This way, a whole frame reaches the terminal in a single write.
+ * Between console_frame_begin and console_frame_end, the buffer grows
+ * instead of being written when it is full(see console_frame.c).
+ *
+ * The program can still use stdio to write to stdout. To keep that output
+ * in order with ours, stdout is made fully buffered, and before the API
+ * adds anything to its own buffer, it checks whether stdout has pending data.
+ * If it has, everything that was before it(our buffer) is written first,
+ * then stdout is flushed.
+ * On Windows there is no way to know if stdout has pending data, so our
+ * buffer is moved into stdout's after each write instead, which does not
+ * cost a system call either.
+ */
+
+/* Writes len bytes to the terminal */
+static void s_console_out_sink(char const *data, size_t len)
+{
+    CONSOLE_S_STAT(bytes, len);
+    if(s_cstate.headless)
+    {
+        console_s_vt_feed(&s_cstate.vt, data, len);
+        return;
+    }
+
+#if defined(_WIN32)
+    CONSOLE_S_STAT(writes, 1);
+    fwrite(data, 1, len, stdout);
+#elif defined(__linux)
+    while(len)
+    {
+        ssize_t written = write(STDOUT_FILENO, data, len);
+        CONSOLE_S_STAT(writes, 1);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            // There is nowhere to report the error
+            // the output is lost
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+#endif
+}
+
+void console_s_out_drain()
+{
+    if(!s_cstate.olen)
+        return;
+    s_console_out_sink(s_cstate.obuf, s_cstate.olen);
+    s_cstate.olen = 0;
+    ++s_cstate.owrites;
+}
+
+int console_s_out_untouched(size_t owrites)
+{
+#if defined(_WIN32)
+    // Our buffer is moved to stdout's after each write
+    // so what was written can never be taken back
+    return 0;
+#elif defined(__linux)
+    // stdout does not go to the headless terminal
+    return s_cstate.obuf
+        && owrites == s_cstate.owrites
+        && (s_cstate.headless || !__fpending(stdout));
+#endif
+}
+
+void console_s_out_order()
+{
+#if defined(__linux)
+    if(!s_cstate.headless && __fpending(stdout))
+    {
+        console_s_out_drain();
+        fflush(stdout);
+        ++s_cstate.oadds;
+    }
+#endif
+}
+
+/*
+ * Makes room for len more bytes in the buffer, without writing it
+ * This is only done during a frame, returns 1 if there is room
+ */
+static int s_console_out_grow(size_t len)
+{
+    if(!s_cstate.frame_active || len > CONSOLE_OBUF_FRAME_MAX - s_cstate.olen)
+        return 0;
+
+    size_t cap = s_cstate.ocap * 2;
+    while(cap < s_cstate.olen + len)
+        cap *= 2;
+    if(cap > CONSOLE_OBUF_FRAME_MAX)
+        cap = CONSOLE_OBUF_FRAME_MAX;
+
+    // The style take back only keeps an offset, it stays valid
+    char *obuf = realloc(s_cstate.obuf, cap);
+    if(!obuf)
+        return 0;
+    s_cstate.obuf = obuf;
+    s_cstate.ocap = cap;
+    return 1;
+}
+
+/* Called after something was added to the buffer */
+static void s_console_out_done()
+{
+    ++s_cstate.owrites;
+    if(!s_cstate.obuffered && !s_cstate.frame_active)
+        console_flush();
+#if defined(_WIN32)
+    else
+        console_s_out_drain();
+#endif
+}
+
+void console_s_out_write(char const *data, size_t len)
+{
+    ++s_cstate.oadds;
+    if(!s_cstate.obuf)
+    {
+        // console_init was not called, or failed
+        s_console_out_sink(data, len);
+        return;
+    }
+
+    console_s_out_order();
+
+    if(len > s_cstate.ocap - s_cstate.olen && !s_console_out_grow(len))
+    {
+        console_s_out_drain();
+
+        // Too big to ever fit in the buffer
+        if(len > s_cstate.ocap)
+        {
+            s_console_out_sink(data, len);
+            s_console_out_done();
+            return;
+        }
+    }
+
+    memcpy(s_cstate.obuf + s_cstate.olen, data, len);
+    s_cstate.olen += len;
+    s_console_out_done();
+}
+
+char *console_s_out_reserve(size_t len)
+{
+    if(!s_cstate.obuf || len > s_cstate.ocap)
+    {
+        // console_init was not called, or failed
+        // the data is put in a scratch buffer, and
+        // written right away by console_s_out_commit
+        static char scratch[256];
+        return len > sizeof(scratch) ? 0 : scratch;
+    }
+
+    console_s_out_order();
+
+    if(len > s_cstate.ocap - s_cstate.olen && !s_console_out_grow(len))
+        console_s_out_drain();
+
+    return s_cstate.obuf + s_cstate.olen;
+}
+
+void console_s_out_commit(char const *data, size_t len)
+{
+    ++s_cstate.oadds;
+    if(data != s_cstate.obuf + s_cstate.olen)
+    {
+        // data was put in the scratch buffer
+        s_console_out_sink(data, len);
+        return;
+    }
+
+    s_cstate.olen += len;
+    s_console_out_done();
+}
+
+void console_s_out_str(char const *str)
+{
+    console_s_out_write(str, strlen(str));
+}
+
+void console_write(char const *data, size_t len)
+{
+    console_s_out_write(data, len);
+}
+
+void console_flush()
+{
+    console_s_out_drain();
+    // Anything in stdout was written after our buffer
+    fflush(stdout);
+}
+
+void console_buffered(int flag)
+{
+    console_flush();
+    s_cstate.obuffered = flag;
+
+    // stdout has to be fully buffered for console_s_out_order to work
+    // Otherwise, we go back to how the API originally worked,
+    // where nothing is buffered
+    if(flag)
+        setvbuf(stdout, 0, _IOFBF, CONSOLE_OBUF_SIZE);
+    else
+        setbuf(stdout, 0);
+}
@@ -0,0 +1,416 @@
+#include "console_api.common.h"
+
+/*
+ * The screen is two grids of cells:
+ *   - The back buffer, which the program draws to
+ *   - The front buffer, which is what the terminal is showing
+ * console_screen_present compares them, and only writes the cells that
+ * differ, moving the cursor and changing the style only when needed.
+ * Drawing a frame where few cells change then costs only a few bytes,
+ * instead of clearing and redrawing the whole terminal.
+ *
+ * When rows of the front buffer are found again in the back buffer, higher
+ * or lower(a list that scrolls, a log that gets a new line), the terminal
+ * is asked to move them itself, with a scrolling region(DECSTBM) and a
+ * scroll up or down(SU/SD). Only the rows that scroll in are then written.
+ * Rows are found by their hash, each row of the back buffer is looked for
+ * in the front buffer, the shift most rows agree on is used.
+ */
+
+/* Cells are compared with memcmp, they must not have padding */
+typedef char s_console_cell_no_padding[
+    sizeof(console_cell) == sizeof(uint32_t) + 6 + sizeof(unsigned short)
+    ? 1 : -1
+];
+
+/* Code point that never matches a real cell, to force redraws */
+#define SCREEN_CH_INVALID (0xFFFFFFFF)
+
+/* Cells a scroll has to save from being written for it to be used */
+#define SCREEN_SCROLL_MIN_CELLS (32)
+
+int console_s_term_size(int *width, int *height)
+{
+    if(s_cstate.headless)
+    {
+        *width = s_cstate.vt.w;
+        *height = s_cstate.vt.h;
+        return 0;
+    }
+
+#if defined(_WIN32)
+    CONSOLE_SCREEN_BUFFER_INFO bufinf;
+    if(!GetConsoleScreenBufferInfo(s_cstate.handle_stdout, &bufinf))
+        return -1;
+    *width = bufinf.srWindow.Right - bufinf.srWindow.Left + 1;
+    *height = bufinf.srWindow.Bottom - bufinf.srWindow.Top + 1;
+#elif defined(__linux)
+    struct winsize ws;
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || !ws.ws_col || !ws.ws_row)
+        return -1;
+    *width = ws.ws_col;
+    *height = ws.ws_row;
+#endif
+    return 0;
+}
+
+int console_screen_init(int width, int height)
+{
+    if(!width || !height)
+    {
+        int term_w, term_h;
+        if(console_s_term_size(&term_w, &term_h))
+            return CONSOLE_SCREEN_ERR;
+        if(!width)
+            width = term_w;
+        if(!height)
+            height = term_h;
+    }
+
+    if(width < 0 || height < 0)
+        return CONSOLE_SCREEN_ERR;
+
+    console_screen_free();
+
+    size_t cell_count = (size_t) width * height;
+    s_cstate.scr_front = malloc(cell_count * sizeof(console_cell));
+    s_cstate.scr_back = malloc(cell_count * sizeof(console_cell));
+    s_cstate.scr_hash = malloc(2 * height * sizeof(uint64_t));
+
+    if(!s_cstate.scr_front || !s_cstate.scr_back || !s_cstate.scr_hash)
+    {
+        console_screen_free();
+        return CONSOLE_SCREEN_ERR;
+    }
+
+    s_cstate.scr_w = width;
+    s_cstate.scr_h = height;
+
+    console_screen_clear();
+    console_screen_invalidate();
+    return CONSOLE_SCREEN_SUCCESS;
+}
+
+void console_screen_free()
+{
+    free(s_cstate.scr_front);
+    free(s_cstate.scr_back);
+    free(s_cstate.scr_hash);
+    s_cstate.scr_front = 0;
+    s_cstate.scr_back = 0;
+    s_cstate.scr_hash = 0;
+    s_cstate.scr_w = 0;
+    s_cstate.scr_h = 0;
+}
+
+void console_screen_size(int *width, int *height)
+{
+    if(width)
+        *width = s_cstate.scr_w;
+    if(height)
+        *height = s_cstate.scr_h;
+}
+
+void console_screen_clear()
+{
+    size_t cell_count = (size_t) s_cstate.scr_w * s_cstate.scr_h;
+    for(size_t i = 0; i < cell_count; ++i)
+    {
+        memset(&s_cstate.scr_back[i], 0, sizeof(console_cell));
+        s_cstate.scr_back[i].ch = ' ';
+    }
+}
+
+void console_screen_invalidate()
+{
+    size_t cell_count = (size_t) s_cstate.scr_w * s_cstate.scr_h;
+    for(size_t i = 0; i < cell_count; ++i)
+        s_cstate.scr_front[i].ch = SCREEN_CH_INVALID;
+}
+
+/*
+ * Cell x of row is about to be overwritten, if it is half of a wide
+ * character, the other half becomes a space
+ */
+static void s_console_screen_split(console_cell *row, int x)
+{
+    if(!row[x].ch && x > 0)
+        row[x - 1].ch = ' ';
+    else if(x + 1 < s_cstate.scr_w && !row[x + 1].ch)
+        row[x + 1].ch = ' ';
+}
+
+void console_screen_put(int x, int y, uint32_t ch, console_style const *style)
+{
+    if(x < 0 || y < 0 || x >= s_cstate.scr_w || y >= s_cstate.scr_h)
+        return;
+
+    int width = console_char_width(ch);
+    if(!width)
+        return;
+
+    console_cell *row = &s_cstate.scr_back[(size_t) y * s_cstate.scr_w];
+    console_cell *cell = &row[x];
+    s_console_screen_split(row, x);
+    if(width == 2)
+    {
+        // A wide character that does not fit on the last column
+        // would go on the next row, a space is put instead
+        if(x + 1 == s_cstate.scr_w)
+            ch = ' ';
+        else
+            s_console_screen_split(row, x + 1);
+    }
+
+    cell->ch = ch;
+    if(style)
+        cell->style = *style;
+    else
+        memset(&cell->style, 0, sizeof(cell->style));
+
+    if(width == 2 && x + 1 < s_cstate.scr_w)
+    {
+        cell[1].ch = 0;
+        cell[1].style = cell->style;
+    }
+}
+
+int console_screen_print(
+    int x, int y,
+    char const *str,
+    console_style const *style
+)
+{
+    int cells = 0;
+    while(*str)
+    {
+        uint32_t cp;
+        str += console_s_dec_utf8(str, &cp);
+        console_screen_put(x + cells, y, cp, style);
+        cells += console_char_width(cp);
+    }
+    return cells;
+}
+
+/* FNV-1a hash of the w cells of row, a word at a time */
+static uint64_t s_console_screen_row_hash(console_cell const *row, int w)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for(int x = 0; x < w; ++x)
+    {
+        uint32_t words[sizeof(console_cell) / sizeof(uint32_t)];
+        memcpy(words, &row[x], sizeof(words));
+        for(size_t i = 0; i < sizeof(words) / sizeof(*words); ++i)
+            hash = (hash ^ words[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/* Number of cells that differ between rows a and b */
+static size_t s_console_screen_row_diff(
+    console_cell const *a,
+    console_cell const *b,
+    int w
+)
+{
+    size_t diff = 0;
+    for(int x = 0; x < w; ++x)
+        diff += memcmp(&a[x], &b[x], sizeof(console_cell)) != 0;
+    return diff;
+}
+
+/*
+ * Makes the terminal move the rows that moved between the front
+ * and the back buffer, and moves them in the front buffer too
+ */
+static void s_console_screen_scroll()
+{
+    int w = s_cstate.scr_w, h = s_cstate.scr_h;
+    console_cell *back = s_cstate.scr_back;
+    console_cell *front = s_cstate.scr_front;
+    size_t row_size = w * sizeof(console_cell);
+
+    // One row that changed cannot have moved in a way worth scrolling
+    int changed = 0;
+    for(int y = 0; y < h && changed < 2; ++y)
+        changed += memcmp(back + y * w, front + y * w, row_size) != 0;
+    if(changed < 2)
+        return;
+
+    uint64_t *back_hash = s_cstate.scr_hash;
+    uint64_t *front_hash = s_cstate.scr_hash + h;
+    for(int y = 0; y < h; ++y)
+    {
+        back_hash[y] = s_console_screen_row_hash(back + y * w, w);
+        front_hash[y] = s_console_screen_row_hash(front + y * w, w);
+    }
+
+    // Row y of the back buffer is row y + shift of the front buffer
+    // for the shift most changed rows agree on
+    int shift = 0, votes = 0;
+    for(int s = 1 - h; s < h; ++s)
+    {
+        int count = 0;
+        for(int y = s < 0 ? -s : 0; y < (s > 0 ? h - s : h); ++y)
+            count += back_hash[y] != front_hash[y]
+                  && back_hash[y] == front_hash[y + s];
+        if(s && count > votes)
+        {
+            shift = s;
+            votes = count;
+        }
+    }
+    if(!votes)
+        return;
+
+    // The rows that moved together, that saves the most cells
+    // The hashes are checked with memcmp, in case two rows have the same
+    int run_top = 0, run_end = 0;
+    size_t saved = 0;
+    int y = shift < 0 ? -shift : 0;
+    int y_end = shift > 0 ? h - shift : h;
+    while(y < y_end)
+    {
+        int top = y;
+        size_t run_saved = 0;
+        while(
+           y < y_end
+        && back_hash[y] == front_hash[y + shift]
+        && !memcmp(back + y * w, front + (y + shift) * w, row_size)
+        )
+        {
+            run_saved += s_console_screen_row_diff(
+                back + y * w, front + y * w, w
+            );
+            ++y;
+        }
+        if(run_saved > saved)
+        {
+            saved = run_saved;
+            run_top = top;
+            run_end = y;
+        }
+        if(y == top)
+            ++y;
+    }
+    if(saved < SCREEN_SCROLL_MIN_CELLS)
+        return;
+
+    // The scrolling region covers where the rows were and where they go
+    int n = shift < 0 ? -shift : shift;
+    int top = shift > 0 ? run_top : run_top - n;
+    int bottom = shift > 0 ? run_end - 1 + n : run_end - 1;
+
+    // The terminal scrolls whole rows, when the screen is narrower it
+    // would move what is right of it too, the rows are written instead
+    // Only asked once scrolling is worth it, it is a system call
+    int term_w, term_h;
+    if(
+       console_s_term_size(&term_w, &term_h)
+    || term_w != w
+    || bottom >= term_h
+    )
+        return;
+
+    // Rows that scroll in take the background of the current style
+    console_style def;
+    memset(&def, 0, sizeof(def));
+    console_s_style_apply(&def);
+
+    // Escape code meaning
+    // \e[t;br sets the scrolling region to rows t to b(origin is 1),
+    //         and moves the cursor to 1,1
+    // \e[nS/\e[nT scroll the region up/down by n rows
+    // \e[r sets the scrolling region back to the whole terminal
+    char *seq = console_s_out_reserve(48);
+    size_t len = 0;
+    seq[len++] = '\e';
+    seq[len++] = '[';
+    len += console_s_enc_uint(seq + len, top + 1);
+    seq[len++] = ';';
+    len += console_s_enc_uint(seq + len, bottom + 1);
+    seq[len++] = 'r';
+    len += console_s_enc_csi_n(seq + len, n, shift > 0 ? 'S' : 'T');
+    memcpy(seq + len, "\e[r", 3);
+    len += 3;
+    console_s_out_commit(seq, len);
+    CONSOLE_S_STAT(seq_other, 3);
+    console_s_cursor_set(0, 0);
+
+    console_cell blank;
+    memset(&blank, 0, sizeof(blank));
+    blank.ch = ' ';
+
+    console_cell *region = front + top * w;
+    size_t kept = (size_t) (bottom - top + 1 - n) * w;
+    int first_blank = top;
+    if(shift > 0)
+    {
+        memmove(region, region + n * w, kept * sizeof(console_cell));
+        first_blank = bottom - n + 1;
+    }
+    else
+        memmove(region + n * w, region, kept * sizeof(console_cell));
+    for(int i = 0; i < n * w; ++i)
+        front[first_blank * w + i] = blank;
+}
+
+void console_screen_present()
+{
+    CONSOLE_S_STAT(frames, 1);
+
+    console_s_draw_apply();
+    s_console_screen_scroll();
+
+    for(int y = 0; y < s_cstate.scr_h; ++y)
+    {
+        size_t row = (size_t) y * s_cstate.scr_w;
+        console_cell *back = s_cstate.scr_back + row;
+        console_cell *front = s_cstate.scr_front + row;
+
+        // Most rows do not change from one frame to the next
+        if(!memcmp(back, front, s_cstate.scr_w * sizeof(console_cell)))
+            continue;
+
+        for(int x = 0; x < s_cstate.scr_w; ++x)
+        {
+            if(!memcmp(&back[x], &front[x], sizeof(console_cell)))
+                continue;
+
+            // The right half of a wide character is written with it
+            if(!back[x].ch)
+            {
+                front[x] = back[x];
+                continue;
+            }
+
+            // The cells that are skipped are the ones that did not
+            // change, they can be written again to get over them
+            console_s_cursor_goto(x, y, front);
+
+            // Only what changed from the previous cell is written
+            console_s_style_apply(&back[x].style);
+
+            char *utf8 = console_s_out_reserve(4);
+            console_s_out_commit(utf8, console_s_enc_utf8(utf8, back[x].ch));
+            front[x] = back[x];
+
+            int end = x + 1;
+            if(end < s_cstate.scr_w && !back[end].ch)
+            {
+                front[end] = back[end];
+                ++end;
+            }
+
+            // After the last column, the cursor stays there until
+            // the next character is written, its position is ambiguous
+            console_s_cursor_set(end < s_cstate.scr_w ? end : -1, y);
+            x = end - 1;
+        }
+    }
+
+    // Go back to the style of the console_* style functions
+    console_s_style_apply(&s_cstate.style);
+
+    console_flush();
+}
@@ -0,0 +1,261 @@
+#include "console_api.common.h"
+
+/*
+ * Sprites, rectangles of cells that are drawn often and rarely change
+ * (borders, headers, the frame of a HUD). console_sprite_create writes the
+ * escape sequences and characters of each row once, like
+ * console_screen_present would, and a blit copies each row to the output
+ * with one write, after moving the cursor.
+ *
+ * Each row starts with a style from a reset, so that it does not depend on
+ * the style the terminal had before it. Cells whose style is different from
+ * the previous cell start with an escape sequence that only changes what is
+ * different, and begin a run. Each run also keeps an escape sequence from a
+ * reset, written in front of the row when the blit starts in the middle of
+ * it(the part left of a clip rectangle, or of the terminal).
+ *
+ * The escape sequences depend on the color depth, the sprite is written
+ * again when it is blitted after the depth changed.
+ */
+
+struct SPRITE_CELL
+{
+    uint32_t pre; /* Offset of its bytes in bytes, its escape sequence if any */
+    uint32_t ch; /* Offset of its character in bytes */
+    uint32_t run; /* Offset of the escape sequence of its style in runs */
+};
+
+struct CONSOLE_SPRITE
+{
+    int w, h;
+    int depth; /* Color depth bytes and runs were written with */
+    console_cell *cells;
+    struct SPRITE_CELL *offs;
+    uint32_t *row_end; /* Offset of the end of each row in bytes */
+    char *bytes; /* The rows, one after the other */
+    char *runs; /* Escape sequences, each after a byte with its length */
+};
+
+/* Returns 1 if cell x,y is the right half of a wide character */
+static int s_console_sprite_right_half(
+    console_sprite const *sprite,
+    int y, int x
+)
+{
+    console_cell const *row = &sprite->cells[y * sprite->w];
+    return x > 0 && !row[x].ch && console_char_width(row[x - 1].ch) == 2;
+}
+
+/*
+ * Writes the bytes and runs of sprite, or only counts them when bytes
+ * and runs are 0, and sets the offsets of the cells and rows
+ */
+static void s_console_sprite_layout(
+    console_sprite *sprite,
+    char *bytes, size_t *bytes_len,
+    char *runs, size_t *runs_len
+)
+{
+    size_t blen = 0, rlen = 0;
+    for(int y = 0; y < sprite->h; ++y)
+    {
+        console_style const *prev = 0;
+        uint32_t run = 0;
+        for(int x = 0; x < sprite->w; ++x)
+        {
+            console_cell const *cell = &sprite->cells[y * sprite->w + x];
+            struct SPRITE_CELL *off = &sprite->offs[y * sprite->w + x];
+            char seq[CONSOLE_S_SGR_MAX];
+
+            off->pre = blen;
+            size_t len = console_s_style_encode(seq, prev, &cell->style);
+            if(len)
+            {
+                if(bytes)
+                    memcpy(bytes + blen, seq, len);
+                blen += len;
+
+                // The first cell of a row already starts from a reset
+                if(prev)
+                    len = console_s_style_encode(seq, 0, &cell->style);
+                if(runs)
+                {
+                    runs[rlen] = len;
+                    memcpy(runs + rlen + 1, seq, len);
+                }
+                run = rlen;
+                rlen += len + 1;
+            }
+            off->run = run;
+
+            // The right half of a wide character is written with it,
+            // what would not take one column is replaced by a space
+            off->ch = blen;
+            if(!s_console_sprite_right_half(sprite, y, x))
+            {
+                char utf8[4];
+                uint32_t ch = console_char_width(cell->ch) ? cell->ch : ' ';
+                blen += console_s_enc_utf8(bytes ? bytes + blen : utf8, ch);
+            }
+            prev = &cell->style;
+        }
+        sprite->row_end[y] = blen;
+    }
+    *bytes_len = blen;
+    *runs_len = rlen;
+}
+
+/* Writes the bytes and runs with the current color depth, 0 on success */
+static int s_console_sprite_encode(console_sprite *sprite)
+{
+    size_t bytes_len, runs_len;
+    s_console_sprite_layout(sprite, 0, &bytes_len, 0, &runs_len);
+
+    char *bytes = realloc(sprite->bytes, bytes_len ? bytes_len : 1);
+    if(!bytes)
+        return -1;
+    sprite->bytes = bytes;
+    char *runs = realloc(sprite->runs, runs_len ? runs_len : 1);
+    if(!runs)
+        return -1;
+    sprite->runs = runs;
+
+    s_console_sprite_layout(sprite, bytes, &bytes_len, runs, &runs_len);
+    sprite->depth = s_cstate.color_depth;
+    return 0;
+}
+
+console_sprite *console_sprite_create(
+    int width, int height,
+    console_cell const *cells
+)
+{
+    if(width <= 0 || height <= 0)
+        return 0;
+
+    console_sprite *sprite = calloc(1, sizeof(console_sprite));
+    if(!sprite)
+        return 0;
+
+    size_t cell_count = (size_t) width * height;
+    sprite->w = width;
+    sprite->h = height;
+    sprite->cells = malloc(cell_count * sizeof(console_cell));
+    sprite->offs = malloc(cell_count * sizeof(struct SPRITE_CELL));
+    sprite->row_end = malloc(height * sizeof(uint32_t));
+
+    if(!sprite->cells || !sprite->offs || !sprite->row_end)
+    {
+        console_sprite_free(sprite);
+        return 0;
+    }
+
+    memcpy(sprite->cells, cells, cell_count * sizeof(console_cell));
+    if(s_console_sprite_encode(sprite))
+    {
+        console_sprite_free(sprite);
+        return 0;
+    }
+    return sprite;
+}
+
+void console_sprite_free(console_sprite *sprite)
+{
+    if(!sprite)
+        return;
+    free(sprite->cells);
+    free(sprite->offs);
+    free(sprite->row_end);
+    free(sprite->bytes);
+    free(sprite->runs);
+    free(sprite);
+}
+
+void console_sprite_blit(console_sprite *sprite, int x, int y)
+{
+    console_sprite_blit_clip(sprite, x, y, 0, 0, INT_MAX, INT_MAX);
+}
+
+void console_sprite_blit_clip(
+    console_sprite *sprite,
+    int x, int y,
+    int clip_x, int clip_y,
+    int clip_w, int clip_h
+)
+{
+    // The part of the sprite that is written, in cells of the sprite,
+    // computed with long longs, as clip_x + clip_w can overflow
+    long long left = 0, top = 0, right = sprite->w, bottom = sprite->h;
+    long long clip_l = clip_x < 0 ? 0 : clip_x;
+    long long clip_t = clip_y < 0 ? 0 : clip_y;
+    if(clip_l - x > left)
+        left = clip_l - x;
+    if(clip_t - y > top)
+        top = clip_t - y;
+    if((long long) clip_x + clip_w - x < right)
+        right = (long long) clip_x + clip_w - x;
+    if((long long) clip_y + clip_h - y < bottom)
+        bottom = (long long) clip_y + clip_h - y;
+    if(left >= right || top >= bottom)
+        return;
+
+    if(sprite->depth != s_cstate.color_depth && s_console_sprite_encode(sprite))
+        return;
+
+    for(int sy = top; sy < bottom; ++sy)
+    {
+        struct SPRITE_CELL const *row = &sprite->offs[sy * sprite->w];
+        int l = left, r = right;
+        console_s_cursor_goto(x + l, y + sy, 0);
+
+        // The escape sequence of the first cell written may only change
+        // what is different from the cell left of it, its run is used
+        size_t from = row[l].pre;
+        if(l)
+        {
+            char const *run = sprite->runs + row[l].run;
+            console_s_out_write(run + 1, (unsigned char) run[0]);
+            from = row[l].ch;
+
+            // Half of a wide character is written as a space
+            if(s_console_sprite_right_half(sprite, sy, l))
+            {
+                CONSOLE_WRITE_LITERAL(" ");
+                from = ++l < r ? row[l].pre : from;
+            }
+        }
+
+        int cut = r < sprite->w && s_console_sprite_right_half(sprite, sy, r);
+        if(cut)
+            --r;
+        if(l < r)
+        {
+            size_t to = r < sprite->w ? row[r].pre : sprite->row_end[sy];
+            console_s_out_write(sprite->bytes + from, to - from);
+        }
+        if(cut && l <= r)
+        {
+            // The escape sequence of the cell is kept, not its character
+            console_s_out_write(
+                sprite->bytes + row[r].pre,
+                row[r].ch - row[r].pre
+            );
+            CONSOLE_WRITE_LITERAL(" ");
+        }
+
+        // Only the cell screen knows where the last column is, after it
+        // the position of the cursor is ambiguous
+        int end = x + right;
+        console_s_cursor_set(
+            s_cstate.scr_w && end < s_cstate.scr_w ? end : -1,
+            y + sy
+        );
+    }
+
+    console_s_style_assume(
+        &sprite->cells[(bottom - 1) * sprite->w + right - 1].style
+    );
+
+    // Go back to the style of the console_* style functions
+    console_s_style_apply(&s_cstate.style);
+}
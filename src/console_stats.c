@@ -0,0 +1,86 @@
+#include "console_api.common.h"
+
+/*
+ * Each thread that counts something gets its own console_stats block,
+ * counting is then a plain add to memory that no other thread writes,
+ * without a lock, nor an atomic read-modify-write. The loads and stores
+ * are relaxed atomics, so that console_stats_get can read the counters of
+ * other threads while they change, it adds up the blocks of all threads.
+ *
+ * Blocks are never given back, a program that starts more than
+ * STATS_THREADS threads that use the API has the extra ones share the last
+ * block. The threads of that block count with an atomic add instead, so
+ * no count is lost, they only take turns on its cache line.
+ */
+
+#define STATS_THREADS (32)
+
+#if defined(CONSOLE_API_STATS)
+static console_stats s_console_stats_blocks[STATS_THREADS];
+static long s_console_stats_claimed; /* Number of blocks given out */
+
+CONSOLE_S_THREAD_LOCAL console_stats *console_s_stats_mine;
+CONSOLE_S_THREAD_LOCAL int console_s_stats_shared;
+
+console_stats *console_s_stats_claim()
+{
+    long idx = CONSOLE_S_FETCH_INC(&s_console_stats_claimed);
+    // The last block is shared by all the threads that get there
+    // including the first one, which cannot know it will be
+    if(idx >= STATS_THREADS - 1)
+    {
+        idx = STATS_THREADS - 1;
+        console_s_stats_shared = 1;
+    }
+
+    console_s_stats_mine = &s_console_stats_blocks[idx];
+    return console_s_stats_mine;
+}
+
+/* Number of blocks in use */
+static size_t s_console_stats_blocks_count()
+{
+#if defined(_MSC_VER)
+    long count = *(long volatile *) &s_console_stats_claimed;
+#else
+    long count = __atomic_load_n(&s_console_stats_claimed, __ATOMIC_ACQUIRE);
+#endif
+    return count > STATS_THREADS ? STATS_THREADS : (size_t) count;
+}
+
+/* Fields of console_stats after enabled, they are all counters */
+#define STATS_FIELDS \
+    ((sizeof(console_stats) - offsetof(console_stats, bytes)) \
+     / sizeof(unsigned long long))
+#endif
+
+void console_stats_get(console_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#if defined(CONSOLE_API_STATS)
+    stats->enabled = 1;
+
+    unsigned long long *sum = &stats->bytes;
+    size_t count = s_console_stats_blocks_count();
+    for(size_t i = 0; i < count; ++i)
+    {
+        unsigned long long *block = &s_console_stats_blocks[i].bytes;
+        for(size_t f = 0; f < STATS_FIELDS; ++f)
+            sum[f] += CONSOLE_S_STAT_LOAD(&block[f]);
+    }
+#endif
+}
+
+void console_stats_reset()
+{
+#if defined(CONSOLE_API_STATS)
+    // Counts made by other threads while this runs can be lost
+    size_t count = s_console_stats_blocks_count();
+    for(size_t i = 0; i < count; ++i)
+    {
+        unsigned long long *block = &s_console_stats_blocks[i].bytes;
+        for(size_t f = 0; f < STATS_FIELDS; ++f)
+            CONSOLE_S_STAT_STORE(&block[f], 0);
+    }
+#endif
+}
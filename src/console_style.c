@@ -1,10 +1,7 @@
 #include "console_api.common.h"
-#include <console_api.h>
 
 /* This is a number of magic values that are used by
    Linux and Windows terminals to set text style */
-#define ENABLE_TERM_GFX_ATTR(n) printf("\e[%dm", n)
-
 #define TERM_GFX_RESET      (0)
 
 #define TERM_GFX_BOLD       (1)
@@ -22,149 +19,416 @@
 #define TERM_GFX_DEF_FG (39) // sets back default foreground color
 #define TERM_GFX_DEF_BG (49) // sets back default background color
 
+#define TERM_GFX_FG     (30) // + color, the 8 first colors
+#define TERM_GFX_BG     (40)
+#define TERM_GFX_FG_HI  (90) // + color - 8, the 8 bright colors
+#define TERM_GFX_BG_HI  (100)
+
+/*
+ * The style functions do not write escape sequences themselves, they only
+ * change s_cstate.style, then ask console_s_style_apply to make the terminal
+ * use it. console_s_style_apply knows which style the terminal is using
+ * (s_cstate.term_style), and:
+ *   - Writes nothing if the style did not change
+ *   - Only writes the attributes that changed, in one escape sequence
+ *   - If the previous style escape sequence is still the last thing that
+ *     was written, it is replaced, so that a number of style calls in a row
+ *     end up as one escape sequence
+ */
+
+/* Appends parameter n to the parameters in seq */
+static size_t s_console_sgr_param(char *seq, size_t len, unsigned char n)
+{
+    seq[len++] = ';';
+    return len + console_s_enc_u8(seq + len, n);
+}
+
+/*
+ * Appends the parameters of color r,g,b, with the color depth
+ * of the terminal, the color was already made one the terminal has
+ */
+static size_t s_console_sgr_color(
+    char *seq, size_t len,
+    int bg,
+    unsigned char r, unsigned char g, unsigned char b
+)
+{
+    int depth = s_cstate.color_depth;
+    if(depth == CONSOLE_COLOR_DEPTH_16)
+    {
+        // Escape code meaning
+        // 30-37/40-47: set foreground/background to one of the 8 colors
+        // 90-97/100-107: same for the 8 bright colors
+        unsigned char rgb[3] = { r, g, b };
+        unsigned char n = console_s_color_index(depth, rgb);
+        if(n < 8)
+            return s_console_sgr_param(
+                seq, len, (bg ? TERM_GFX_BG : TERM_GFX_FG) + n
+            );
+        return s_console_sgr_param(
+            seq, len, (bg ? TERM_GFX_BG_HI : TERM_GFX_FG_HI) + n - 8
+        );
+    }
+
+    // Escape code meaning
+    // 38/48: set foreground/background color
+    // 5: use color n of the 256 colors
+    // 2: use 24-bit color
+    // Read docs/console_api.md#terminal-styling for more details
+    // Windows mimics this behavior as well when
+    // Virtual terminal sequences are enabled
+    len = s_console_sgr_param(seq, len, bg ? 48 : 38);
+    if(depth == CONSOLE_COLOR_DEPTH_256)
+    {
+        unsigned char rgb[3] = { r, g, b };
+        len = s_console_sgr_param(seq, len, 5);
+        return s_console_sgr_param(seq, len, console_s_color_index(depth, rgb));
+    }
+    len = s_console_sgr_param(seq, len, 2);
+    len = s_console_sgr_param(seq, len, r);
+    len = s_console_sgr_param(seq, len, g);
+    return s_console_sgr_param(seq, len, b);
+}
+
+/* The style as the terminal will really show it */
+static console_style s_console_style_effective(console_style const *style)
+{
+    console_style eff = *style;
+    if(!(eff.attr & CONSOLE_ATTR_FG))
+        eff.fr = eff.fg = eff.fb = 0;
+    if(!(eff.attr & CONSOLE_ATTR_BG))
+        eff.br = eff.bg = eff.bb = 0;
+#if defined(_WIN32)
+    // windows does not support dim,
+    // instead we set colors to half
+    // their values
+    if(eff.attr & CONSOLE_ATTR_DIM)
+    {
+        eff.fr /= 2;
+        eff.fg /= 2;
+        eff.fb /= 2;
+        eff.br /= 2;
+        eff.bg /= 2;
+        eff.bb /= 2;
+    }
+    // blink is not supported by windows either
+    eff.attr &= ~(CONSOLE_ATTR_DIM | CONSOLE_ATTR_BLINK);
+#endif
+
+    // Colors are replaced by the ones the terminal has, so that
+    // colors that look the same to it are not written again
+    if(s_cstate.color_depth != CONSOLE_COLOR_DEPTH_TRUE)
+    {
+        unsigned char fg[3] = { eff.fr, eff.fg, eff.fb };
+        unsigned char bg[3] = { eff.br, eff.bg, eff.bb };
+        if(eff.attr & CONSOLE_ATTR_FG)
+        {
+            console_s_color_quantize(s_cstate.color_depth, fg);
+            eff.fr = fg[0];
+            eff.fg = fg[1];
+            eff.fb = fg[2];
+        }
+        if(eff.attr & CONSOLE_ATTR_BG)
+        {
+            console_s_color_quantize(s_cstate.color_depth, bg);
+            eff.br = bg[0];
+            eff.bg = bg[1];
+            eff.bb = bg[2];
+        }
+    }
+    return eff;
+}
+
+/*
+ * Writes in seq the parameters, each starting with ';', that change
+ * the terminal from style `from` to style `to`
+ * Returns the length of seq
+ */
+static size_t s_console_sgr_diff(
+    char *seq,
+    console_style const *from,
+    console_style const *to
+)
+{
+    size_t len = 0;
+    unsigned changed = from->attr ^ to->attr;
+
+    // There is no way to only turn off bold or dim,
+    // 22 turns both off, the one that stays is turned on again
+    int intensity_off =
+       (from->attr & CONSOLE_ATTR_BOLD && !(to->attr & CONSOLE_ATTR_BOLD))
+    || (from->attr & CONSOLE_ATTR_DIM && !(to->attr & CONSOLE_ATTR_DIM));
+
+    if(intensity_off)
+    {
+        len = s_console_sgr_param(seq, len, TERM_GFX_NBOLD);
+        changed |= to->attr & (CONSOLE_ATTR_BOLD | CONSOLE_ATTR_DIM);
+    }
+
+    if(changed & to->attr & CONSOLE_ATTR_BOLD)
+        len = s_console_sgr_param(seq, len, TERM_GFX_BOLD);
+    if(changed & to->attr & CONSOLE_ATTR_DIM)
+        len = s_console_sgr_param(seq, len, TERM_GFX_DIM);
+
+    if(changed & CONSOLE_ATTR_UNDERLINE)
+        len = s_console_sgr_param(
+            seq, len,
+            to->attr & CONSOLE_ATTR_UNDERLINE
+            ? TERM_GFX_UNDERLINE : TERM_GFX_NUNDERLINE
+        );
+    if(changed & CONSOLE_ATTR_BLINK)
+        len = s_console_sgr_param(
+            seq, len,
+            to->attr & CONSOLE_ATTR_BLINK ? TERM_GFX_BLINK : TERM_GFX_NBLINK
+        );
+    if(changed & CONSOLE_ATTR_SWITCH)
+        len = s_console_sgr_param(
+            seq, len,
+            to->attr & CONSOLE_ATTR_SWITCH
+            ? TERM_GFX_REV_VID : TERM_GFX_NREV_VID
+        );
+
+    if(
+       changed & CONSOLE_ATTR_FG
+    || from->fr != to->fr || from->fg != to->fg || from->fb != to->fb
+    )
+    {
+        if(to->attr & CONSOLE_ATTR_FG)
+            len = s_console_sgr_color(seq, len, 0, to->fr, to->fg, to->fb);
+        else
+            len = s_console_sgr_param(seq, len, TERM_GFX_DEF_FG);
+    }
+
+    if(
+       changed & CONSOLE_ATTR_BG
+    || from->br != to->br || from->bg != to->bg || from->bb != to->bb
+    )
+    {
+        if(to->attr & CONSOLE_ATTR_BG)
+            len = s_console_sgr_color(seq, len, 1, to->br, to->bg, to->bb);
+        else
+            len = s_console_sgr_param(seq, len, TERM_GFX_DEF_BG);
+    }
+
+    return len;
+}
+
+/*
+ * Writes in seq the escape sequence that changes the terminal from style
+ * from(0 if it is not known) to style to, both already effective
+ * Returns its length, 0 if the style does not change
+ */
+static size_t s_console_sgr_write(
+    char *seq,
+    console_style const *from,
+    console_style const *to
+)
+{
+    // Two ways to get to `to` are compared:
+    //   - Only changing what is different
+    //   - Resetting everything, then setting what `to` needs
+    // The shortest one is used
+    // The first one is written straight to seq
+    // The parameters start at seq + 1, the first ';' is replaced by '['
+    char reset_seq[CONSOLE_S_SGR_MAX];
+    console_style def;
+    memset(&def, 0, sizeof(def));
+
+    size_t reset_len = s_console_sgr_param(reset_seq, 0, TERM_GFX_RESET);
+    reset_len += s_console_sgr_diff(reset_seq + reset_len, &def, to);
+
+    size_t params_len = 0;
+    if(from)
+        params_len = s_console_sgr_diff(seq + 1, from, to);
+
+    if(!from || params_len >= reset_len)
+    {
+        memcpy(seq + 1, reset_seq, reset_len);
+        params_len = reset_len;
+    }
+
+    // This happens when the style is the same
+    if(!params_len)
+        return 0;
+
+    size_t len = params_len + 1;
+    seq[0] = '\e';
+    seq[1] = '[';
+    seq[len++] = 'm';
+    return len;
+}
+
+void console_s_style_apply(console_style const *style)
+{
+    console_style target = s_console_style_effective(style);
+
+    if(
+       s_cstate.term_style_known
+    && !memcmp(&target, &s_cstate.term_style, sizeof(target))
+    )
+        return;
+
+    console_style from = s_cstate.term_style;
+    int from_known = s_cstate.term_style_known;
+
+    // If our previous style escape sequence is still the last output
+    // it is taken back, and replaced by one that does both changes
+    if(s_cstate.sgr_valid && console_s_out_untouched(s_cstate.sgr_owrites))
+    {
+        s_cstate.olen = s_cstate.sgr_off;
+        CONSOLE_S_STAT(seq_style, -1);
+        from = s_cstate.sgr_base;
+        from_known = s_cstate.sgr_base_known;
+    }
+    s_cstate.sgr_valid = 0;
+
+    char *seq = console_s_out_reserve(CONSOLE_S_SGR_MAX);
+    size_t sgr_off = s_cstate.olen;
+    size_t oadds = s_cstate.oadds;
+    size_t len = s_console_sgr_write(seq, from_known ? &from : 0, &target);
+
+    s_cstate.term_style = target;
+    s_cstate.term_style_known = 1;
+
+    // This happens when we took back the previous escape
+    // sequence, and the style went back to what it was before it
+    if(!len)
+        return;
+
+    console_s_out_commit(seq, len);
+    CONSOLE_S_STAT(seq_style, 1);
+
+    // Style changes do not move the cursor
+    if(s_cstate.cur_oadds == oadds)
+        s_cstate.cur_oadds = s_cstate.oadds;
+
+    // The escape sequence can only be taken back later if it is
+    // still in the buffer, committing it may have flushed it
+    if(s_cstate.obuf && s_cstate.olen == sgr_off + len)
+    {
+        s_cstate.sgr_valid = 1;
+        s_cstate.sgr_off = sgr_off;
+        s_cstate.sgr_owrites = s_cstate.owrites;
+        s_cstate.sgr_base = from;
+        s_cstate.sgr_base_known = from_known;
+    }
+}
+
+size_t console_s_style_encode(
+    char *seq,
+    console_style const *from,
+    console_style const *to
+)
+{
+    console_style eff_to = s_console_style_effective(to);
+    if(!from)
+        return s_console_sgr_write(seq, 0, &eff_to);
+    console_style eff_from = s_console_style_effective(from);
+    return s_console_sgr_write(seq, &eff_from, &eff_to);
+}
+
+void console_s_style_assume(console_style const *style)
+{
+    s_cstate.term_style = s_console_style_effective(style);
+    s_cstate.term_style_known = 1;
+    s_cstate.sgr_valid = 0;
+}
+
+int console_s_style_is_current(console_style const *style)
+{
+    console_style target = s_console_style_effective(style);
+    return s_cstate.term_style_known
+        && !memcmp(&target, &s_cstate.term_style, sizeof(target));
+}
+
+void console_style_set(console_style const *style)
+{
+    s_cstate.style = *style;
+    console_s_style_apply(&s_cstate.style);
+}
+
+void console_style_get(console_style *style)
+{
+    *style = s_cstate.style;
+}
+
 void console_color_foreground_reset()
 {
-    ENABLE_TERM_GFX_ATTR(TERM_GFX_DEF_FG);
+    s_cstate.style.attr &= ~CONSOLE_ATTR_FG;
+    console_s_style_apply(&s_cstate.style);
 }
 void console_color_background_reset()
 {
-    ENABLE_TERM_GFX_ATTR(TERM_GFX_DEF_BG);
+    s_cstate.style.attr &= ~CONSOLE_ATTR_BG;
+    console_s_style_apply(&s_cstate.style);
 }
 
 
 void console_color_foreground(int r, int g, int b)
 {
-    s_cstate.style_fr = r;
-    s_cstate.style_fg = g;
-    s_cstate.style_fb = b;
-    // Escape code meaning
-    // \e
-    // 38: set foreground color
-    // 2: use 24-bit color
-    // m: terminate terminal style command
-    // Read docs/console_api.md#terminal-styling for more details
-    // Windows mimics this behavior as well when
-    // Virtual terminal sequences are enabled
-    printf("\e[38;2;%d;%d;%dm", r, g, b);
+    s_cstate.style.fr = r;
+    s_cstate.style.fg = g;
+    s_cstate.style.fb = b;
+    s_cstate.style.attr |= CONSOLE_ATTR_FG;
+    console_s_style_apply(&s_cstate.style);
 }
 void console_color_background(int r, int g, int b)
 {
-    s_cstate.style_br = r;
-    s_cstate.style_bg = g;
-    s_cstate.style_bb = b;
-    // Escape code meaning
-    // \e
-    // 48: set background color
-    // 2: use 24-bit color
-    // m: terminate terminal style command
-    // Read docs/console_api.md#terminal-styling for more details
-    // Windows mimics this behavior as well when
-    // Virtual terminal sequences are enabled
-    printf("\e[48;2;%d;%d;%dm", r, g, b);
+    s_cstate.style.br = r;
+    s_cstate.style.bg = g;
+    s_cstate.style.bb = b;
+    s_cstate.style.attr |= CONSOLE_ATTR_BG;
+    console_s_style_apply(&s_cstate.style);
 }
 void console_color_switch(int flag)
 {
-    s_cstate.style_fb_switch = flag;
     if(flag)
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_REV_VID);
+        s_cstate.style.attr |= CONSOLE_ATTR_SWITCH;
     else
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_NREV_VID);
+        s_cstate.style.attr &= ~CONSOLE_ATTR_SWITCH;
+    console_s_style_apply(&s_cstate.style);
 }
 
 void console_bold(int flag)
 {
-    s_cstate.style_bold = flag;
     // bold implies not dim
+    // The terminal cannot turn off only one of them, so
+    // turning bold off has always turned dim off as well
+    s_cstate.style.attr &= ~(CONSOLE_ATTR_BOLD | CONSOLE_ATTR_DIM);
     if(flag)
-        console_dim(0);
-    if(flag)
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_BOLD);
-    else
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_NBOLD);
+        s_cstate.style.attr |= CONSOLE_ATTR_BOLD;
+    console_s_style_apply(&s_cstate.style);
 }
 void console_dim(int flag)
 {
-    s_cstate.style_dim = flag;
     // dim implies not bold
+    s_cstate.style.attr &= ~(CONSOLE_ATTR_BOLD | CONSOLE_ATTR_DIM);
     if(flag)
-        console_bold(0);
-    // windows does not support dim,
-    // instead we set colors to half
-    // their values
-#if defined(_WIN32)
-    if(flag && !s_cstate.style_dim)
-    {
-        console_color_foreground(
-            s_cstate.style_fr / 2,
-            s_cstate.style_fg / 2,
-            s_cstate.style_fb / 2
-        );
-        console_color_background(
-            s_cstate.style_br / 2,
-            s_cstate.style_bg / 2,
-            s_cstate.style_bb / 2
-        );
-    }
-    else if(!flag && s_cstate.style_dim)
-    {
-        console_color_foreground(
-            s_cstate.style_fr * 2,
-            s_cstate.style_fg * 2,
-            s_cstate.style_fb * 2
-        );
-        console_color_background(
-            s_cstate.style_br * 2,
-            s_cstate.style_bg * 2,
-            s_cstate.style_bb * 2
-        );
-    }
-#elif defined(__linux)
-    if(flag)
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_DIM);
-    else
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_NDIM);
-#endif
+        s_cstate.style.attr |= CONSOLE_ATTR_DIM;
+    console_s_style_apply(&s_cstate.style);
 }
 void console_blink(int flag)
 {
-    s_cstate.style_blink = flag;
-    // This is not supported by windows
-#if defined(__linux)
     if(flag)
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_BLINK);
+        s_cstate.style.attr |= CONSOLE_ATTR_BLINK;
     else
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_NBLINK);
-#endif
+        s_cstate.style.attr &= ~CONSOLE_ATTR_BLINK;
+    console_s_style_apply(&s_cstate.style);
 }
 void console_underline(int flag)
 {
-    s_cstate.style_underline = flag;
     if(flag)
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_UNDERLINE);
+        s_cstate.style.attr |= CONSOLE_ATTR_UNDERLINE;
     else
-        ENABLE_TERM_GFX_ATTR(TERM_GFX_NUNDERLINE);
+        s_cstate.style.attr &= ~CONSOLE_ATTR_UNDERLINE;
+    console_s_style_apply(&s_cstate.style);
 }
 void console_style_reset()
 {
-    // FIXME: We just assume these are the defaults
-    // While some terminal emulators on mights
-    // have different defaults
-
-    s_cstate.style_fr = 255;
-    s_cstate.style_fg = 255;
-    s_cstate.style_fb = 255;
-
-    s_cstate.style_br = 0;
-    s_cstate.style_bg = 0;
-    s_cstate.style_bb = 0;
-
-    s_cstate.style_fb_switch = 0;
-
-    s_cstate.style_bold = 0;
-    s_cstate.style_underline = 0;
-    s_cstate.style_blink = 0;
-
-    ENABLE_TERM_GFX_ATTR(TERM_GFX_RESET);
+    // The default style uses the default colors
+    // of the terminal, whatever they are
+    memset(&s_cstate.style, 0, sizeof(s_cstate.style));
+    console_s_style_apply(&s_cstate.style);
 }
 
 
@@ -178,6 +442,8 @@ void console_title(char const *title)
     // Which most linux terminals abide by
     // If it does not work, it is not a problem really
     // Windows mimics the behavior
-    printf("\e]2;%s\e\\", title);
+    CONSOLE_WRITE_LITERAL("\e]2;");
+    console_s_out_str(title);
+    CONSOLE_WRITE_LITERAL("\e\\");
+    CONSOLE_S_STAT(seq_other, 1);
 }
-
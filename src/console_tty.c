@@ -0,0 +1,619 @@
+#include "console_api.common.h"
+
+#if defined(__linux)
+/*
+ * The terminal stays in raw mode(see console_init) for the whole life
+ * of the program, so what is typed in it reaches stdin byte by byte,
+ * without echo, and without being turned into lines.
+ * The bytes are read into s_cstate.tty_in, and decoded into keys from there.
+ * Bytes that are not used yet stay in the buffer for the next reader,
+ * so nothing typed ahead is lost.
+ *
+ * Keys other than text are sent by the terminal as escape sequences
+ * https://invisible-island.net/xterm/ctlseqs/ctlseqs.html#h2-PC-Style-Function-Keys
+ *
+ * When no keyboard device can be read, the key functions use the keys
+ * decoded here instead(CONSOLE_INPUT_TTY). Terminals only send a key when
+ * it is pressed, or auto repeated, so the key is considered down for
+ * TTY_HOLD millis after that. This cannot tell a held key from a tap: the
+ * first auto repeat only comes after the repeat delay(250 to 600 millis),
+ * so a held key is seen down, then up until its repeats start. Terminals
+ * that support the kitty keyboard protocol are asked to also send releases,
+ * the keys are then down exactly as long as they are held.
+ * https://sw.kovidgoyal.net/kitty/keyboard-protocol/
+ */
+
+/* How long to wait for the rest of an escape sequence before deciding
+   that ESC was a key on its own, in millis */
+#define TTY_ESC_WAIT (25)
+
+/* How long a key stays down after the terminal sent it, in millis
+   It is longer than the interval between auto repeats, so a key stays down
+   once its repeats have started, but shorter than the delay before the
+   first repeat, so a tap is not seen as held. Between the press and the
+   first repeat, a held key is seen up: held keys are only reliable with
+   the releases of the kitty keyboard protocol */
+#define TTY_HOLD (50)
+
+/* How long console_init waits for the terminal to answer, in millis */
+#define TTY_REPLY_WAIT (200)
+
+/* kitty keyboard protocol flags: disambiguate escape codes(1), report
+   event types(2), and report all keys as escape codes(8), without 8 the
+   release of text keys is not reported */
+#define TTY_KITTY_FLAGS "11"
+
+/* Linux key codes of the letters a-z */
+static int const s_console_linux_tty_letters[26] =
+{
+    KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I,
+    KEY_J, KEY_K, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R,
+    KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z
+};
+
+/* Linux key codes of the digits 0-9 */
+static int const s_console_linux_tty_digits[10] =
+{
+    KEY_0, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9
+};
+
+/*
+ * Headless terminal, the program adds the input itself
+ * console_headless_on_input's callback is its chance to do it
+ */
+static int s_console_linux_tty_headless_fill(int timeout)
+{
+    size_t len = s_cstate.tty_len;
+    if(s_cstate.headless_on_input)
+        s_cstate.headless_on_input(s_cstate.headless_ctx);
+    if(s_cstate.tty_len != len)
+        return s_cstate.tty_len - len;
+
+    // Nothing will ever be typed, waiting forever would never return
+    if(timeout < 0)
+        return -1;
+    if(timeout)
+    {
+        long long waited = CONSOLE_S_STAT_NOW();
+        poll(0, 0, timeout);
+        CONSOLE_S_STAT(wait_us, CONSOLE_S_STAT_NOW() - waited);
+    }
+    return 0;
+}
+
+int console_s_linux_tty_fill(int timeout)
+{
+    if(s_cstate.tty_len == sizeof(s_cstate.tty_in))
+        return 0;
+    if(s_cstate.headless)
+        return s_console_linux_tty_headless_fill(timeout);
+
+    struct pollfd pfd;
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+
+    long long waited = CONSOLE_S_STAT_NOW();
+    int ready = poll(&pfd, 1, timeout);
+    if(timeout)
+        CONSOLE_S_STAT(wait_us, CONSOLE_S_STAT_NOW() - waited);
+    if(ready < 0)
+        return errno == EINTR ? 0 : -1;
+    if(!ready)
+        return 0;
+    if(!(pfd.revents & POLLIN))
+        return -1;
+
+    ssize_t rd = read(
+        STDIN_FILENO,
+        s_cstate.tty_in + s_cstate.tty_len,
+        sizeof(s_cstate.tty_in) - s_cstate.tty_len
+    );
+
+    // Nothing to read after poll said there was means stdin was closed
+    if(rd <= 0)
+        return rd < 0 && (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+
+    s_cstate.tty_len += rd;
+    return rd;
+}
+
+void console_s_linux_tty_discard()
+{
+    if(!s_cstate.headless)
+        tcflush(STDIN_FILENO, TCIFLUSH);
+    s_cstate.tty_len = 0;
+}
+
+/* Removes the first len bytes of the buffer */
+static void s_console_linux_tty_consume(size_t len)
+{
+    s_cstate.tty_len -= len;
+    memmove(s_cstate.tty_in, s_cstate.tty_in + len, s_cstate.tty_len);
+}
+
+/* Key that types the ASCII character c, 0 if none */
+static int s_console_linux_tty_char_key(uint32_t c)
+{
+    if(c >= 'a' && c <= 'z')
+        return s_console_linux_tty_letters[c - 'a'];
+    if(c >= 'A' && c <= 'Z')
+        return s_console_linux_tty_letters[c - 'A'];
+    if(c >= '0' && c <= '9')
+        return s_console_linux_tty_digits[c - '0'];
+    if(c == ' ')
+        return CONSOLE_KEY_SPACE;
+    return 0;
+}
+
+/* Key of the final byte of a CSI or SS3 sequence, 0 if unknown */
+static int s_console_linux_tty_final_key(unsigned char final)
+{
+    switch(final)
+    {
+        case 'A': return CONSOLE_KEY_UP;
+        case 'B': return CONSOLE_KEY_DOWN;
+        case 'C': return CONSOLE_KEY_RIGHT;
+        case 'D': return CONSOLE_KEY_LEFT;
+        case 'H': return CONSOLE_KEY_HOME;
+        case 'F': return CONSOLE_KEY_END;
+    }
+    return 0;
+}
+
+/* Key of \e[n~ sequences, 0 if unknown */
+static int s_console_linux_tty_tilde_key(unsigned n)
+{
+    switch(n)
+    {
+        case 1: case 7: return CONSOLE_KEY_HOME;
+        case 4: case 8: return CONSOLE_KEY_END;
+        case 3: return KEY_DELETE;
+        case 5: return CONSOLE_KEY_PAGEUP;
+        case 6: return CONSOLE_KEY_PAGEDOWN;
+    }
+    return 0;
+}
+
+/*
+ * Fills key from a kitty keyboard protocol key, \e[code;mods:event u
+ * The modifiers are 1 + a bit mask, shift is 1, alt 2 and ctrl 4
+ */
+static void s_console_linux_tty_kitty_key(
+    console_tty_key *key,
+    uint32_t code,
+    unsigned mods
+)
+{
+    unsigned mask = mods ? mods - 1 : 0;
+
+    switch(code)
+    {
+        case 9: key->key = CONSOLE_KEY_TAB; return;
+        case 13: key->key = CONSOLE_KEY_ENTER; return;
+        case 27: key->key = CONSOLE_KEY_ESCAPE; return;
+        case 127: key->key = CONSOLE_KEY_BACKSPACE; return;
+    }
+
+    key->key = s_console_linux_tty_char_key(code);
+
+    // Only the keys that type text are reported as text
+    // the Unicode private use area holds the codes of function keys
+    if(code < 0x20 || code == 0x7F || (code >= 0xE000 && code <= 0xF8FF))
+        return;
+
+    if(mask & 4)
+    {
+        if(code >= 'a' && code <= 'z')
+            key->ctrl = code - 'a' + 'A';
+        return;
+    }
+    if(mask & 2 || key->type == CONSOLE_EVENT_RELEASE)
+        return;
+
+    if(mask & 1 && code >= 'a' && code <= 'z')
+        code = code - 'a' + 'A';
+    key->text_len = console_s_enc_utf8(key->text, code);
+}
+
+/*
+ * Decodes the escape sequence at the start of the buffer
+ * Returns its length, or 0 if it is not complete yet
+ * key->key is left at 0 for sequences that are not known
+ */
+static size_t s_console_linux_tty_escape(console_tty_key *key)
+{
+    unsigned char const *in = s_cstate.tty_in;
+    size_t len = s_cstate.tty_len;
+
+    if(len < 2)
+        return 0;
+
+    if(in[1] == 'O')
+    {
+        // SS3, sent for arrows by terminals in application mode
+        if(len < 3)
+            return 0;
+        key->key = s_console_linux_tty_final_key(in[2]);
+        return 3;
+    }
+
+    if(in[1] != '[')
+    {
+        // Alt+key, the ESC is returned on its own
+        key->key = CONSOLE_KEY_ESCAPE;
+        return 1;
+    }
+
+    // CSI: \e[ then parameters, separated by ';', each one can have
+    // sub parameters separated by ':', then one final byte
+    // Only the first sub parameter is kept
+    unsigned params[3] = { 0, 0, 0 };
+    unsigned subs[3] = { 0, 0, 0 };
+    size_t param = 0;
+    int sub = 0;
+    char private = 0;
+
+    size_t i;
+    for(i = 2; i < len; ++i)
+    {
+        unsigned char c = in[i];
+        if(c >= '0' && c <= '9')
+        {
+            if(param >= 3 || sub > 1)
+                continue;
+            unsigned *value = sub ? &subs[param] : &params[param];
+            *value = *value * 10 + (c - '0');
+        }
+        else if(c == ':')
+            ++sub;
+        else if(c == ';')
+        {
+            ++param;
+            sub = 0;
+        }
+        else if(c >= 0x3C && c <= 0x3F)
+            private = c;
+        else if(c >= 0x40 && c <= 0x7E)
+            break;
+    }
+
+    if(i == len)
+        return 0;
+
+    unsigned char final = in[i];
+    if(private == '?')
+    {
+        key->reply = final;
+        key->param = params[0];
+        return i + 1;
+    }
+
+    // kitty adds the event type as a sub parameter of the modifiers
+    // 1 for press, 2 for repeat, and 3 for release
+    switch(subs[1])
+    {
+        case 2: key->type = CONSOLE_EVENT_REPEAT; break;
+        case 3: key->type = CONSOLE_EVENT_RELEASE; break;
+    }
+
+    if(final == 'u')
+        s_console_linux_tty_kitty_key(key, params[0], params[1]);
+    else if(final == '~')
+        key->key = s_console_linux_tty_tilde_key(params[0]);
+    else
+        key->key = s_console_linux_tty_final_key(final);
+    return i + 1;
+}
+
+/*
+ * Decodes the key at the start of the buffer
+ * Returns its length, or 0 if it is not complete yet
+ */
+static size_t s_console_linux_tty_decode(console_tty_key *key)
+{
+    unsigned char const *in = s_cstate.tty_in;
+    memset(key, 0, sizeof(*key));
+    key->type = CONSOLE_EVENT_PRESS;
+
+    if(in[0] == '\e')
+        return s_console_linux_tty_escape(key);
+
+    // Some keys send the same byte as a Ctrl+letter, the byte is
+    // the key: Ctrl+M and Ctrl+J are ENTER, Ctrl+H is BACKSPACE, and
+    // Ctrl+I is TAB
+    if(in[0] == '\r' || in[0] == '\n')
+    {
+        key->key = CONSOLE_KEY_ENTER;
+        return 1;
+    }
+    if(in[0] == 0x7F || in[0] == '\b')
+    {
+        key->key = CONSOLE_KEY_BACKSPACE;
+        return 1;
+    }
+    if(in[0] == '\t')
+    {
+        key->key = CONSOLE_KEY_TAB;
+        return 1;
+    }
+    // The other control characters are Ctrl+letter(0x01-0x1A),
+    // Ctrl+Space or Ctrl+@(0x00), and Ctrl+\ ] ^ _(0x1C-0x1F)
+    if(in[0] < 0x20)
+    {
+        key->ctrl = in[0] + '@';
+        return 1;
+    }
+
+    size_t len = 1;
+    if(in[0] >= 0xF0)
+        len = 4;
+    else if(in[0] >= 0xE0)
+        len = 3;
+    else if(in[0] >= 0xC0)
+        len = 2;
+
+    if(s_cstate.tty_len < len)
+        return 0;
+
+    memcpy(key->text, in, len);
+    key->text_len = len;
+    if(len == 1)
+        key->key = s_console_linux_tty_char_key(in[0]);
+    return len;
+}
+
+/*
+ * Takes the next complete key from the buffer, never waits
+ * Returns 1 if key was filled, 0 if there is no complete key
+ */
+static int s_console_linux_tty_next(console_tty_key *key)
+{
+    while(s_cstate.tty_len)
+    {
+        size_t len = s_console_linux_tty_decode(key);
+        if(!len)
+            return 0;
+
+        s_console_linux_tty_consume(len);
+        // Sequences that are not known are skipped
+        if(key->key || key->ctrl || key->text_len || key->reply)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Called when the start of the buffer stayed incomplete for TTY_ESC_WAIT
+ * An ESC that is not followed by anything is the ESC key, and
+ * truncated UTF-8 is thrown away
+ * Returns 1 if key was filled
+ */
+static int s_console_linux_tty_partial(console_tty_key *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->type = CONSOLE_EVENT_PRESS;
+
+    int esc = s_cstate.tty_in[0] == '\e';
+    s_console_linux_tty_consume(1);
+    if(esc)
+        key->key = CONSOLE_KEY_ESCAPE;
+    return esc;
+}
+
+int console_s_linux_tty_key(console_tty_key *key, long long deadline)
+{
+    while(1)
+    {
+        if(s_console_linux_tty_next(key))
+            return 1;
+
+        int timeout = -1;
+        if(deadline)
+        {
+            long long left = (deadline - console_time_us()) / 1000;
+            if(left <= 0)
+                return 0;
+            timeout = left > INT_MAX ? INT_MAX : (int) left;
+        }
+
+        // An incomplete key is only waited for a short time
+        int partial = s_cstate.tty_len != 0;
+        if(partial && (timeout < 0 || timeout > TTY_ESC_WAIT))
+            timeout = TTY_ESC_WAIT;
+
+        int rd = console_s_linux_tty_fill(timeout);
+        if(rd < 0)
+            return -1;
+
+        if(!rd && partial && s_console_linux_tty_partial(key))
+            return 1;
+    }
+}
+
+void console_s_linux_tty_kitty(int on)
+{
+    if(!s_cstate.tty_kitty)
+        return;
+
+    // Escape code meaning
+    // \e[>flags u pushes flags on the stack of keyboard modes
+    // \e[<u pops them
+    if(on)
+        CONSOLE_WRITE_LITERAL("\e[>" TTY_KITTY_FLAGS "u");
+    else
+        CONSOLE_WRITE_LITERAL("\e[<u");
+    CONSOLE_S_STAT(seq_other, 1);
+}
+
+void console_s_linux_tty_open()
+{
+    memset(&s_cstate.tty_kmap, 0, sizeof(s_cstate.tty_kmap));
+    s_cstate.tty_held_count = 0;
+    s_cstate.tty_hold_us = TTY_HOLD * 1000;
+    s_cstate.tty_kitty = 0;
+
+    // Escape code meaning
+    // \e[?u asks for the kitty keyboard flags, only terminals that
+    // support the protocol answer(\e[?flags u)
+    // \e[c asks for the terminal attributes, all terminals answer it
+    // so once it is answered, we know that the first one will not be
+    CONSOLE_WRITE_LITERAL("\e[?u\e[c");
+    CONSOLE_S_STAT(seq_other, 2);
+    console_flush();
+
+    long long deadline = console_time_us() + TTY_REPLY_WAIT * 1000;
+    console_tty_key key;
+    int kitty = 0;
+    while(console_s_linux_tty_key(&key, deadline) > 0)
+    {
+        if(key.reply == 'u')
+            kitty = 1;
+        else if(key.reply == 'c')
+            break;
+    }
+
+    s_cstate.tty_kitty = kitty;
+    console_s_linux_tty_kitty(1);
+}
+
+void console_s_linux_tty_close()
+{
+    console_s_linux_tty_kitty(0);
+    s_cstate.tty_kitty = 0;
+}
+
+/* Sets the state of key in tty_kmap, returns 1 if it changed */
+static int s_console_linux_tty_set(int key, int down)
+{
+    if(key <= 0 || key >= CONSOLE_KEY_COUNT)
+        return 0;
+
+    int was_down = CONSOLE_KEYMAP_TEST(&s_cstate.tty_kmap, key);
+    if(down)
+        s_cstate.tty_kmap.bits[key / 8] |= 1 << key % 8;
+    else
+        s_cstate.tty_kmap.bits[key / 8] &= ~(1 << key % 8);
+    return was_down != down;
+}
+
+/* Releases the keys whose hold time is over, returns how many */
+static int s_console_linux_tty_expire(long long now)
+{
+    int changes = 0;
+    size_t kept = 0;
+    for(size_t i = 0; i < s_cstate.tty_held_count; ++i)
+    {
+        if(s_cstate.tty_held[i].release_at > now)
+            s_cstate.tty_held[kept++] = s_cstate.tty_held[i];
+        else
+            changes += s_console_linux_tty_set(s_cstate.tty_held[i].key, 0);
+    }
+    s_cstate.tty_held_count = kept;
+    return changes;
+}
+
+/* Key whose state key changes, 0 if none */
+static int s_console_linux_tty_code(console_tty_key const *key)
+{
+    // Ctrl+letter is reported as the letter, and Ctrl+Space as SPACE
+    // The bytes of ENTER, BACKSPACE and TAB never get here, they are
+    // decoded as those keys. Ctrl+\ ] ^ _ have no key
+    if(!key->key && key->ctrl >= 'A' && key->ctrl <= 'Z')
+        return s_console_linux_tty_letters[key->ctrl - 'A'];
+    if(!key->key && key->ctrl == '@')
+        return CONSOLE_KEY_SPACE;
+    if(key->key <= 0 || key->key >= CONSOLE_KEY_COUNT)
+        return 0;
+    return key->key;
+}
+
+/* Applies a key typed in the terminal to tty_kmap */
+static int s_console_linux_tty_apply(int code, int down, long long now)
+{
+    if(s_cstate.tty_kitty || !down)
+        return s_console_linux_tty_set(code, down);
+
+    // Without releases, the key is held until tty_hold_us
+    // after the last time the terminal sent it
+    size_t i;
+    for(i = 0; i < s_cstate.tty_held_count; ++i)
+        if(s_cstate.tty_held[i].key == code)
+            break;
+
+    if(i == s_cstate.tty_held_count)
+    {
+        if(i == CONSOLE_TTY_HELD_MAX)
+            return 0;
+        ++s_cstate.tty_held_count;
+    }
+
+    s_cstate.tty_held[i].key = code;
+    s_cstate.tty_held[i].release_at = now + s_cstate.tty_hold_us;
+    return s_console_linux_tty_set(code, 1);
+}
+
+int console_s_linux_tty_pump(int timeout)
+{
+    long long now = console_time_us();
+    int changes = s_console_linux_tty_expire(now);
+
+    // Keys that are held wake the wait up when they are released
+    if(timeout && s_cstate.tty_held_count)
+    {
+        long long next = s_cstate.tty_held[0].release_at;
+        for(size_t i = 1; i < s_cstate.tty_held_count; ++i)
+            if(s_cstate.tty_held[i].release_at < next)
+                next = s_cstate.tty_held[i].release_at;
+
+        int left = (int) ((next - now + 999) / 1000);
+        if(timeout < 0 || left < timeout)
+            timeout = left;
+    }
+
+    // Keys that are already in the buffer are applied without waiting
+    if(!changes && !s_cstate.tty_len)
+    {
+        if(console_s_linux_tty_fill(timeout) < 0)
+            return -1;
+    }
+    else if(console_s_linux_tty_fill(0) < 0)
+        return -1;
+
+    // A key released above is not pressed again in the same call
+    now = console_time_us();
+    console_tty_key key;
+    while(!changes)
+    {
+        if(!s_console_linux_tty_next(&key))
+        {
+            // An incomplete key at the start of the buffer
+            if(!s_cstate.tty_len)
+                break;
+            if(console_s_linux_tty_fill(TTY_ESC_WAIT) > 0)
+                continue;
+            if(!s_console_linux_tty_partial(&key))
+                continue;
+        }
+
+        int code = s_console_linux_tty_code(&key);
+        if(!code)
+            continue;
+        int down = key.type != CONSOLE_EVENT_RELEASE;
+
+        // A press and its release can arrive together, only one key
+        // changes per call, or the caller would never see the press
+        // The next keys stay in the buffer for the next call
+        if(s_console_linux_tty_apply(code, down, now))
+        {
+            ++changes;
+            break;
+        }
+    }
+
+    // Keys held while we waited are released, unless a key already
+    // changed, a key pressed above is then down until the next call
+    if(!changes)
+        changes = s_console_linux_tty_expire(now);
+    return changes;
+}
+#endif
@@ -0,0 +1,540 @@
+#include "console_api.common.h"
+
+/*
+ * A terminal emulator small enough to live in the program: a grid of
+ * cells, a cursor, and a parser for the escape sequences the API writes
+ * (and a few more that any terminal has, so that programs can use
+ * console_write with their own sequences).
+ *   - Text is UTF-8, one code point per cell, lines wrap like xterm:
+ *     writing the last column does not move the cursor, the next cell
+ *     goes on the next line
+ *   - \n is a carriage return and a line feed, like the terminal driver
+ *     does with output processing on(see console_init)
+ *   - Cursor moves: CUP(H, f), CUU(A), CUD(B), CUF(C), CUB(D), CNL(E),
+ *     CPL(F), CHA(G), VPA(d), save and restore(s, u, \e7, \e8)
+ *   - Erases: ED(J), EL(K), they use the background of the current style
+ *   - Scrolling: DECSTBM(r), SU(S), SD(T), line feeds at the bottom
+ *     of the scrolling region
+ *   - SGR(m), with the 8/16 colors, 256 colors and direct colors
+ *   - OSC 0 and 2 set the title
+ * Everything else is parsed and ignored.
+ * https://invisible-island.net/xterm/ctlseqs/ctlseqs.html
+ */
+
+/* Parser states */
+#define VT_GROUND  (0)
+#define VT_ESC     (1) /* After ESC */
+#define VT_ESC_IM  (2) /* After ESC and an intermediate byte(\e(B...) */
+#define VT_CSI     (3) /* After \e[ */
+#define VT_OSC     (4) /* After \e] */
+#define VT_OSC_ESC (5) /* After ESC in an OSC, \e\\ ends it */
+
+int console_s_vt_init(console_vt *vt, int width, int height)
+{
+    memset(vt, 0, sizeof(*vt));
+    if(width <= 0 || height <= 0)
+        return -1;
+
+    vt->cells = malloc(sizeof(*vt->cells) * width * height);
+    if(!vt->cells)
+        return -1;
+
+    vt->w = width;
+    vt->h = height;
+    vt->bottom = height - 1;
+    for(int i = 0; i < width * height; ++i)
+    {
+        memset(&vt->cells[i], 0, sizeof(vt->cells[i]));
+        vt->cells[i].ch = ' ';
+    }
+    return 0;
+}
+
+void console_s_vt_free(console_vt *vt)
+{
+    free(vt->cells);
+    memset(vt, 0, sizeof(*vt));
+}
+
+/* Fills count cells from cell i with blanks */
+static void s_console_vt_blank(console_vt *vt, int i, int count)
+{
+    // Erased cells take the background of the current style
+    console_cell blank;
+    memset(&blank, 0, sizeof(blank));
+    blank.ch = ' ';
+    if(vt->style.attr & CONSOLE_ATTR_BG)
+    {
+        blank.style.br = vt->style.br;
+        blank.style.bg = vt->style.bg;
+        blank.style.bb = vt->style.bb;
+        blank.style.attr = CONSOLE_ATTR_BG;
+    }
+
+    for(int end = i + count; i < end; ++i)
+        vt->cells[i] = blank;
+}
+
+/* Scrolls the scrolling region up(n > 0) or down(n < 0) by n rows */
+static void s_console_vt_scroll(console_vt *vt, int n)
+{
+    int rows = vt->bottom - vt->top + 1;
+    int shift = n < 0 ? -n : n;
+    if(shift > rows)
+        shift = rows;
+
+    console_cell *top = vt->cells + vt->top * vt->w;
+    size_t kept = (size_t) (rows - shift) * vt->w;
+    if(n > 0)
+    {
+        memmove(top, top + shift * vt->w, kept * sizeof(*top));
+        int first = vt->bottom - shift + 1;
+        s_console_vt_blank(vt, first * vt->w, shift * vt->w);
+    }
+    else
+    {
+        memmove(top + shift * vt->w, top, kept * sizeof(*top));
+        s_console_vt_blank(vt, vt->top * vt->w, shift * vt->w);
+    }
+}
+
+static void s_console_vt_line_feed(console_vt *vt)
+{
+    vt->wrap = 0;
+    if(vt->cy == vt->bottom)
+        s_console_vt_scroll(vt, 1);
+    else if(vt->cy < vt->h - 1)
+        ++vt->cy;
+}
+
+/*
+ * Cell x of row is about to be overwritten, if it is half of a wide
+ * character, the other half is erased
+ */
+static void s_console_vt_split(console_vt *vt, console_cell *row, int x)
+{
+    if(!row[x].ch && x > 0)
+        row[x - 1].ch = ' ';
+    else if(x + 1 < vt->w && !row[x + 1].ch)
+        row[x + 1].ch = ' ';
+}
+
+/*
+ * Writes cp at the cursor, and moves the cursor, wide characters take
+ * two cells, the right one has ch 0, characters that take no column
+ * are dropped, as the cells cannot hold them
+ */
+static void s_console_vt_put(console_vt *vt, uint32_t cp)
+{
+    int width = console_char_width(cp);
+    if(!width)
+        return;
+
+    // A wide character that does not fit on the last column
+    // goes to the next row
+    if(vt->wrap || (width == 2 && vt->cx == vt->w - 1 && vt->w > 1))
+    {
+        vt->cx = 0;
+        s_console_vt_line_feed(vt);
+    }
+
+    console_cell *row = &vt->cells[vt->cy * vt->w];
+    s_console_vt_split(vt, row, vt->cx);
+    if(width == 2 && vt->cx + 1 < vt->w)
+        s_console_vt_split(vt, row, vt->cx + 1);
+    row[vt->cx].ch = cp;
+    row[vt->cx].style = vt->style;
+    if(width == 2 && vt->cx + 1 < vt->w)
+    {
+        ++vt->cx;
+        row[vt->cx].ch = 0;
+        row[vt->cx].style = vt->style;
+    }
+
+    if(vt->cx == vt->w - 1)
+        vt->wrap = 1;
+    else
+        ++vt->cx;
+}
+
+static void s_console_vt_goto(console_vt *vt, int x, int y)
+{
+    vt->cx = x < 0 ? 0 : x >= vt->w ? vt->w - 1 : x;
+    vt->cy = y < 0 ? 0 : y >= vt->h ? vt->h - 1 : y;
+    vt->wrap = 0;
+}
+
+/* Control characters, the C0 set */
+static void s_console_vt_control(console_vt *vt, unsigned char c)
+{
+    switch(c)
+    {
+        case '\b':
+            if(vt->cx > 0)
+                --vt->cx;
+            vt->wrap = 0;
+            break;
+        case '\t':
+            s_console_vt_goto(vt, (vt->cx / 8 + 1) * 8, vt->cy);
+            break;
+        case '\n': case '\v': case '\f':
+            // Output processing turns \n into \r\n
+            vt->cx = 0;
+            s_console_vt_line_feed(vt);
+            break;
+        case '\r':
+            vt->cx = 0;
+            vt->wrap = 0;
+            break;
+        case '\e':
+            vt->state = VT_ESC;
+            break;
+    }
+}
+
+/* Color of a 256 colors SGR code */
+static void s_console_vt_set_color(
+    console_vt *vt,
+    int bg,
+    unsigned char const rgb[3]
+)
+{
+    if(bg)
+    {
+        vt->style.br = rgb[0];
+        vt->style.bg = rgb[1];
+        vt->style.bb = rgb[2];
+        vt->style.attr |= CONSOLE_ATTR_BG;
+    }
+    else
+    {
+        vt->style.fr = rgb[0];
+        vt->style.fg = rgb[1];
+        vt->style.fb = rgb[2];
+        vt->style.attr |= CONSOLE_ATTR_FG;
+    }
+}
+
+static void s_console_vt_sgr(console_vt *vt)
+{
+    // \e[m is \e[0m
+    if(!vt->param_count)
+        vt->param_count = 1;
+
+    for(size_t i = 0; i < vt->param_count; ++i)
+    {
+        unsigned p = vt->params[i];
+        unsigned char rgb[3];
+
+        if(p == 38 || p == 48)
+        {
+            // 38;5;n is one of the 256 colors, 38;2;r;g;b a direct color
+            int bg = p == 48;
+            if(i + 2 < vt->param_count && vt->params[i + 1] == 5)
+            {
+                console_s_color256(vt->params[i + 2] & 0xFF, rgb);
+                s_console_vt_set_color(vt, bg, rgb);
+                i += 2;
+            }
+            else if(i + 4 < vt->param_count && vt->params[i + 1] == 2)
+            {
+                rgb[0] = vt->params[i + 2];
+                rgb[1] = vt->params[i + 3];
+                rgb[2] = vt->params[i + 4];
+                s_console_vt_set_color(vt, bg, rgb);
+                i += 4;
+            }
+            else
+                i = vt->param_count;
+            continue;
+        }
+
+        if((p >= 30 && p <= 37) || (p >= 40 && p <= 47))
+        {
+            console_s_color256(p % 10, rgb);
+            s_console_vt_set_color(vt, p >= 40, rgb);
+            continue;
+        }
+        if((p >= 90 && p <= 97) || (p >= 100 && p <= 107))
+        {
+            console_s_color256(p % 10 + 8, rgb);
+            s_console_vt_set_color(vt, p >= 100, rgb);
+            continue;
+        }
+
+        switch(p)
+        {
+            case 0:
+                memset(&vt->style, 0, sizeof(vt->style));
+                break;
+            case 1: vt->style.attr |= CONSOLE_ATTR_BOLD; break;
+            case 2: vt->style.attr |= CONSOLE_ATTR_DIM; break;
+            case 4: vt->style.attr |= CONSOLE_ATTR_UNDERLINE; break;
+            case 5: vt->style.attr |= CONSOLE_ATTR_BLINK; break;
+            case 7: vt->style.attr |= CONSOLE_ATTR_SWITCH; break;
+            case 22:
+                vt->style.attr &= ~(CONSOLE_ATTR_BOLD | CONSOLE_ATTR_DIM);
+                break;
+            case 24: vt->style.attr &= ~CONSOLE_ATTR_UNDERLINE; break;
+            case 25: vt->style.attr &= ~CONSOLE_ATTR_BLINK; break;
+            case 27: vt->style.attr &= ~CONSOLE_ATTR_SWITCH; break;
+            case 39:
+                vt->style.fr = vt->style.fg = vt->style.fb = 0;
+                vt->style.attr &= ~CONSOLE_ATTR_FG;
+                break;
+            case 49:
+                vt->style.br = vt->style.bg = vt->style.bb = 0;
+                vt->style.attr &= ~CONSOLE_ATTR_BG;
+                break;
+        }
+    }
+}
+
+/* Runs the CSI sequence that ends with final */
+static void s_console_vt_csi(console_vt *vt, unsigned char final)
+{
+    // Sequences with a private marker are modes and queries
+    // (\e[?25l, \e[>11u, \e[?u...), none of them change the cells
+    if(vt->private)
+        return;
+
+    unsigned p0 = vt->param_count ? vt->params[0] : 0;
+    unsigned p1 = vt->param_count > 1 ? vt->params[1] : 0;
+    int n = p0 ? (int) p0 : 1;
+    int cur = vt->cy * vt->w + vt->cx;
+
+    switch(final)
+    {
+        case 'H': case 'f':
+            s_console_vt_goto(vt, (p1 ? (int) p1 : 1) - 1, n - 1);
+            break;
+        case 'A': s_console_vt_goto(vt, vt->cx, vt->cy - n); break;
+        case 'B': s_console_vt_goto(vt, vt->cx, vt->cy + n); break;
+        case 'C': s_console_vt_goto(vt, vt->cx + n, vt->cy); break;
+        case 'D': s_console_vt_goto(vt, vt->cx - n, vt->cy); break;
+        case 'E': s_console_vt_goto(vt, 0, vt->cy + n); break;
+        case 'F': s_console_vt_goto(vt, 0, vt->cy - n); break;
+        case 'G': s_console_vt_goto(vt, n - 1, vt->cy); break;
+        case 'd': s_console_vt_goto(vt, vt->cx, n - 1); break;
+        case 'J':
+            if(p0 == 0)
+                s_console_vt_blank(vt, cur, vt->w * vt->h - cur);
+            else if(p0 == 1)
+                s_console_vt_blank(vt, 0, cur + 1);
+            else if(p0 == 2)
+                s_console_vt_blank(vt, 0, vt->w * vt->h);
+            // 3 clears the scrollback, which is not kept
+            break;
+        case 'K':
+        {
+            int line = vt->cy * vt->w;
+            if(p0 == 0)
+                s_console_vt_blank(vt, cur, line + vt->w - cur);
+            else if(p0 == 1)
+                s_console_vt_blank(vt, line, vt->cx + 1);
+            else
+                s_console_vt_blank(vt, line, vt->w);
+            break;
+        }
+        case 'S': s_console_vt_scroll(vt, n); break;
+        case 'T': s_console_vt_scroll(vt, -n); break;
+        case 'r':
+        {
+            int top = (p0 ? (int) p0 : 1) - 1;
+            int bottom = (p1 ? (int) p1 : vt->h) - 1;
+            if(bottom >= vt->h)
+                bottom = vt->h - 1;
+            if(top >= bottom)
+                break;
+            vt->top = top;
+            vt->bottom = bottom;
+            s_console_vt_goto(vt, 0, 0);
+            break;
+        }
+        case 'm': s_console_vt_sgr(vt); break;
+        case 's':
+            vt->saved_cx = vt->cx;
+            vt->saved_cy = vt->cy;
+            break;
+        case 'u':
+            s_console_vt_goto(vt, vt->saved_cx, vt->saved_cy);
+            break;
+    }
+}
+
+/* Runs the finished OSC sequence */
+static void s_console_vt_osc(console_vt *vt)
+{
+    // \e]0;title and \e]2;title set the title
+    if(
+       vt->osc_len >= 2
+    && (vt->osc[0] == '0' || vt->osc[0] == '2')
+    && vt->osc[1] == ';'
+    )
+    {
+        memcpy(vt->title, vt->osc + 2, vt->osc_len - 2);
+        vt->title[vt->osc_len - 2] = 0;
+    }
+    vt->osc_len = 0;
+}
+
+/* Decodes one byte of UTF-8 text */
+static void s_console_vt_text(console_vt *vt, unsigned char c)
+{
+    if(c < 0x80)
+    {
+        vt->cp_left = 0;
+        s_console_vt_put(vt, c);
+        return;
+    }
+
+    if((c & 0xC0) == 0x80)
+    {
+        // A continuation byte without a lead byte is invalid
+        if(!vt->cp_left)
+        {
+            s_console_vt_put(vt, 0xFFFD);
+            return;
+        }
+        vt->cp = vt->cp << 6 | (c & 0x3F);
+        if(!--vt->cp_left)
+            s_console_vt_put(vt, vt->cp);
+        return;
+    }
+
+    if(vt->cp_left)
+        s_console_vt_put(vt, 0xFFFD);
+
+    if((c & 0xE0) == 0xC0)
+    {
+        vt->cp = c & 0x1F;
+        vt->cp_left = 1;
+    }
+    else if((c & 0xF0) == 0xE0)
+    {
+        vt->cp = c & 0x0F;
+        vt->cp_left = 2;
+    }
+    else if((c & 0xF8) == 0xF0)
+    {
+        vt->cp = c & 0x07;
+        vt->cp_left = 3;
+    }
+    else
+    {
+        vt->cp_left = 0;
+        s_console_vt_put(vt, 0xFFFD);
+    }
+}
+
+void console_s_vt_feed(console_vt *vt, char const *data, size_t len)
+{
+    unsigned char const *in = (unsigned char const *) data;
+    unsigned char const *end = in + len;
+
+    while(in < end)
+    {
+        unsigned char c = *in++;
+        switch(vt->state)
+        {
+            case VT_GROUND:
+                if(c >= 0x20 && c < 0x7F && !vt->cp_left)
+                {
+                    // Runs of ASCII text are most of the output
+                    // they are written without going through the decoder
+                    s_console_vt_put(vt, c);
+                    while(in < end && *in >= 0x20 && *in < 0x7F)
+                        s_console_vt_put(vt, *in++);
+                }
+                else if(c < 0x20)
+                    s_console_vt_control(vt, c);
+                else if(c != 0x7F)
+                    s_console_vt_text(vt, c);
+                break;
+
+            case VT_ESC:
+                vt->state = VT_GROUND;
+                if(c == '[')
+                {
+                    vt->state = VT_CSI;
+                    vt->param_count = 0;
+                    vt->private = 0;
+                    memset(vt->params, 0, sizeof(vt->params));
+                }
+                else if(c == ']')
+                {
+                    vt->state = VT_OSC;
+                    vt->osc_len = 0;
+                }
+                else if(c >= 0x20 && c <= 0x2F)
+                    vt->state = VT_ESC_IM;
+                else if(c == '7')
+                {
+                    vt->saved_cx = vt->cx;
+                    vt->saved_cy = vt->cy;
+                }
+                else if(c == '8')
+                    s_console_vt_goto(vt, vt->saved_cx, vt->saved_cy);
+                break;
+
+            case VT_ESC_IM:
+                // \e(B and the like select character sets
+                if(c >= 0x30)
+                    vt->state = VT_GROUND;
+                break;
+
+            case VT_CSI:
+                if(c >= '0' && c <= '9')
+                {
+                    if(!vt->param_count)
+                        vt->param_count = 1;
+                    if(vt->param_count <= CONSOLE_VT_PARAMS_MAX)
+                    {
+                        unsigned *p = &vt->params[vt->param_count - 1];
+                        *p = *p * 10 + (c - '0');
+                    }
+                }
+                else if(c == ';' || c == ':')
+                {
+                    // An empty parameter is a 0
+                    if(!vt->param_count)
+                        vt->param_count = 1;
+                    if(vt->param_count < CONSOLE_VT_PARAMS_MAX)
+                        ++vt->param_count;
+                }
+                else if(c >= 0x3C && c <= 0x3F)
+                    vt->private = c;
+                else if(c >= 0x40 && c <= 0x7E)
+                {
+                    vt->state = VT_GROUND;
+                    s_console_vt_csi(vt, c);
+                }
+                else if(c < 0x20)
+                    s_console_vt_control(vt, c);
+                break;
+
+            case VT_OSC:
+                if(c == 0x07)
+                {
+                    vt->state = VT_GROUND;
+                    s_console_vt_osc(vt);
+                }
+                else if(c == '\e')
+                    vt->state = VT_OSC_ESC;
+                else if(vt->osc_len < CONSOLE_VT_OSC_MAX - 1)
+                    vt->osc[vt->osc_len++] = c;
+                break;
+
+            case VT_OSC_ESC:
+                vt->state = VT_GROUND;
+                s_console_vt_osc(vt);
+                // Anything other than \e\\ starts a new sequence
+                if(c != '\\')
+                {
+                    vt->state = VT_ESC;
+                    --in;
+                }
+                break;
+        }
+    }
+}
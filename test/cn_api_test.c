@@ -0,0 +1,842 @@
+/*
+ * cn_api_test, checks what the API puts on the terminal
+ *
+ * Each test runs the API on the headless terminal(console_init_headless),
+ * feeds it known frames or keys, then checks the cells of the emulated
+ * terminal, the same cells a real terminal would show.
+ *
+ * For each test, one line is printed, and the failed checks before it
+ * Usage: cn_api_test [filter], only the tests whose name contains
+ * filter are run. Returns 0 if all tests passed
+ */
+#include "console_api.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Checks that failed in the current test */
+static int s_test_failed;
+
+#define TEST_CHECK(cond) \
+    do \
+    { \
+        if(!(cond)) \
+        { \
+            printf("  %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            ++s_test_failed; \
+        } \
+    } while(0)
+
+/* Checks the text of row y of the terminal */
+#define TEST_ROW(y, text) \
+    do \
+    { \
+        char row_[256]; \
+        console_headless_row((y), row_, sizeof(row_)); \
+        if(strcmp(row_, (text))) \
+        { \
+            printf( \
+                "  %s:%d: row %d is \"%s\", not \"%s\"\n", \
+                __FILE__, __LINE__, (y), row_, (text) \
+            ); \
+            ++s_test_failed; \
+        } \
+    } while(0)
+
+/* Presenting writes the cells that changed, with their style */
+static void s_test_screen_present()
+{
+    console_init_headless(20, 4);
+    console_screen_init(0, 0);
+
+    static console_style const red =
+        CONSOLE_STYLE_FG(255, 0, 0, CONSOLE_ATTR_BOLD);
+    console_screen_print(2, 1, "hello", &red);
+    console_screen_present();
+    TEST_ROW(0, "");
+    TEST_ROW(1, "  hello");
+    console_cell const *cell = console_headless_cell(2, 1);
+    TEST_CHECK(cell->style.attr & CONSOLE_ATTR_BOLD);
+    TEST_CHECK(cell->style.fr == 255 && !cell->style.fg && !cell->style.fb);
+    TEST_CHECK(!(console_headless_cell(1, 1)->style.attr & CONSOLE_ATTR_BOLD));
+
+    // Cells that did not change are left as they are
+    console_screen_print(2, 1, "HE", 0);
+    console_screen_present();
+    TEST_ROW(1, "  HEllo");
+    TEST_CHECK(!(console_headless_cell(3, 1)->style.attr & CONSOLE_ATTR_BOLD));
+    TEST_CHECK(console_headless_cell(4, 1)->style.attr & CONSOLE_ATTR_BOLD);
+
+    console_screen_free();
+    console_cleanup();
+}
+
+/* The counters follow what is written to the terminal */
+static void s_test_stats()
+{
+    console_init_headless(20, 4);
+    console_screen_init(0, 0);
+
+    console_stats stats;
+    console_stats_get(&stats);
+    if(!stats.enabled)
+    {
+        // Built with CNAPI_STATS=OFF
+        console_screen_free();
+        console_cleanup();
+        return;
+    }
+
+    console_stats_reset();
+    console_stats_get(&stats);
+    TEST_CHECK(!stats.bytes && !stats.writes && !stats.frames);
+
+    CONSOLE_WRITE_LITERAL("abc");
+    console_flush();
+    console_stats_get(&stats);
+    TEST_CHECK(stats.bytes == 3);
+    // The headless terminal is not written with system calls
+    TEST_CHECK(!stats.writes);
+
+    console_screen_print(0, 1, "x", 0);
+    console_screen_present();
+    console_screen_present();
+    console_stats_get(&stats);
+    TEST_CHECK(stats.frames == 2);
+    TEST_CHECK(stats.seq_cursor >= 1);
+    TEST_CHECK(stats.bytes > 4);
+
+    console_screen_free();
+    console_cleanup();
+}
+
+/* A frame is written in one go, and frames are paced at the rate */
+static void s_test_frame_pacing()
+{
+    console_init_headless(20, 4);
+
+    console_stats stats;
+    console_stats_reset();
+    console_frame_begin();
+    // More than the output buffer holds outside of a frame
+    for(int i = 0; i < 1000; ++i)
+        CONSOLE_WRITE_LITERAL("0123456789");
+    console_stats_get(&stats);
+    TEST_CHECK(!stats.bytes);
+    TEST_CHECK(console_frame_end() == CONSOLE_FRAME_ON_TIME);
+    console_stats_get(&stats);
+    TEST_CHECK(!stats.enabled || stats.bytes == 10000);
+
+    console_frame_rate(100);
+    long long start = console_time_us();
+    for(int i = 0; i < 5; ++i)
+    {
+        console_frame_begin();
+        console_frame_end();
+    }
+    // The first deadline is one period after the first frame began
+    TEST_CHECK(console_time_us() - start >= 5 * 10000);
+
+    console_frame_stats frame_stats;
+    console_frame_stats_get(&frame_stats);
+    TEST_CHECK(frame_stats.frames == 5);
+    TEST_CHECK(frame_stats.period_us == 10000);
+
+    console_frame_rate(0);
+    console_cleanup();
+}
+
+/* Checks the foreground color of cell x,y of the terminal */
+static int s_test_cell_fg(int x, int y, int r, int g, int b)
+{
+    console_style const *style = &console_headless_cell(x, y)->style;
+    return (style->attr & CONSOLE_ATTR_FG)
+        && style->fr == r && style->fg == g && style->fb == b;
+}
+
+/* Colors are replaced by the closest one of the 256 or 16 colors */
+static void s_test_color_depth()
+{
+    console_init_headless(20, 4);
+    TEST_CHECK(console_color_depth() == CONSOLE_COLOR_DEPTH_TRUE);
+
+    console_color_depth_set(CONSOLE_COLOR_DEPTH_256);
+    // Color cube, 196 is 255,0,0
+    console_color_foreground(250, 10, 10);
+    CONSOLE_WRITE_LITERAL("a");
+    // Gray ramp, 244 is 128,128,128, closer than the cube's 135
+    console_color_foreground(127, 129, 128);
+    CONSOLE_WRITE_LITERAL("b");
+    TEST_CHECK(s_test_cell_fg(0, 0, 255, 0, 0));
+    TEST_CHECK(s_test_cell_fg(1, 0, 128, 128, 128));
+
+    // A color that maps to the same entry writes nothing
+    console_stats stats;
+    console_flush();
+    console_stats_reset();
+    console_color_foreground(128, 128, 127);
+    console_flush();
+    console_stats_get(&stats);
+    TEST_CHECK(!stats.bytes);
+
+    console_color_depth_set(CONSOLE_COLOR_DEPTH_16);
+    // Red(31) is 205,0,0, bright red(91) 255,0,0
+    console_color_foreground(190, 20, 0);
+    CONSOLE_WRITE_LITERAL("c");
+    console_color_foreground(250, 10, 10);
+    CONSOLE_WRITE_LITERAL("d");
+    TEST_CHECK(s_test_cell_fg(2, 0, 205, 0, 0));
+    TEST_CHECK(s_test_cell_fg(3, 0, 255, 0, 0));
+
+    // Blue(34) is 0,0,238, the sequence is as short as it gets
+    console_stats_reset();
+    console_color_foreground(20, 20, 230);
+    CONSOLE_WRITE_LITERAL("e");
+    TEST_CHECK(s_test_cell_fg(4, 0, 0, 0, 238));
+    console_stats_get(&stats);
+    TEST_CHECK(!stats.enabled || stats.bytes == sizeof("\e[34me") - 1);
+
+    console_style_reset();
+    console_cleanup();
+}
+
+/* Moves the cursor to x,y, checks where it went and how many bytes it took */
+static void s_test_goto_check(int x, int y, size_t bytes, int line)
+{
+    console_stats stats;
+    console_flush();
+    console_stats_reset();
+    console_goto(x, y);
+
+    int cx, cy;
+    console_headless_cursor(&cx, &cy);
+    console_stats_get(&stats);
+    if(cx != x || cy != y || (stats.enabled && stats.bytes != bytes))
+    {
+        printf(
+            "  %s:%d: moved to %d,%d in %llu bytes, not %d,%d in %zu\n",
+            __FILE__, line, cx, cy, stats.bytes, x, y, bytes
+        );
+        ++s_test_failed;
+    }
+}
+
+/* Each move is made with the shortest sequence that gets there */
+static void s_test_cursor_moves()
+{
+    console_init_headless(80, 24);
+    console_clear();
+
+    s_test_goto_check(10, 5, sizeof("\e[6;11H") - 1, __LINE__);
+    s_test_goto_check(12, 5, sizeof("\e[2C") - 1, __LINE__);
+    s_test_goto_check(11, 5, sizeof("\b") - 1, __LINE__);
+    s_test_goto_check(0, 6, sizeof("\r\n") - 1, __LINE__);
+    s_test_goto_check(0, 3, sizeof("\e[3A") - 1, __LINE__);
+    s_test_goto_check(0, 3, 0, __LINE__);
+
+    // After a write the API did not follow, the position is not known
+    CONSOLE_WRITE_LITERAL("abc");
+    s_test_goto_check(5, 3, sizeof("\e[4;6H") - 1, __LINE__);
+
+    console_cleanup();
+}
+
+/* Text of line n of the scroll tests, each line differs in every cell */
+static void s_test_line(char *buf, int width, int n)
+{
+    for(int x = 0; x < width; ++x)
+        buf[x] = 'A' + (x * 7 + n * 13) % 26;
+    buf[width] = 0;
+}
+
+/*
+ * A log tailed at the bottom of the screen, each frame moves all rows up
+ * by one, present has the terminal scroll them
+ */
+static void s_test_screen_scroll()
+{
+    console_init_headless(40, 10);
+    console_screen_init(0, 0);
+
+    char line[41];
+    for(int frame = 0; frame < 30; ++frame)
+    {
+        for(int y = 0; y < 10; ++y)
+        {
+            s_test_line(line, 40, frame + y);
+            console_screen_print(0, y, line, 0);
+        }
+        console_stats stats;
+        console_stats_reset();
+        console_screen_present();
+        console_stats_get(&stats);
+
+        for(int y = 0; y < 10; ++y)
+        {
+            s_test_line(line, 40, frame + y);
+            TEST_ROW(y, line);
+        }
+        // Only the row that scrolled in is written, not all 400 cells
+        if(frame)
+            TEST_CHECK(stats.bytes < 100);
+    }
+
+    console_screen_free();
+    console_cleanup();
+}
+
+/*
+ * Same, with a screen narrower than the terminal, what is right of
+ * the screen must not move with its rows
+ */
+static void s_test_screen_scroll_narrow()
+{
+    console_init_headless(40, 10);
+    console_screen_init(30, 10);
+
+    for(int y = 0; y < 10; ++y)
+    {
+        console_goto(35, y);
+        CONSOLE_WRITE_LITERAL("|");
+    }
+
+    char line[41];
+    for(int frame = 0; frame < 30; ++frame)
+    {
+        for(int y = 0; y < 10; ++y)
+        {
+            s_test_line(line, 30, frame + y);
+            console_screen_print(0, y, line, 0);
+        }
+        console_screen_present();
+
+        for(int y = 0; y < 10; ++y)
+        {
+            s_test_line(line, 30, frame + y);
+            memcpy(line + 30, "     |", 7);
+            TEST_ROW(y, line);
+        }
+    }
+
+    console_screen_free();
+    console_cleanup();
+}
+
+/* Row a thread of s_test_draw_threads draws, and what its commit returned */
+typedef struct
+{
+    int y;
+    int status;
+} test_draw;
+
+static void *s_test_draw_thread(void *ctx)
+{
+    test_draw *draw = ctx;
+    char text[16];
+    snprintf(text, sizeof(text), "thread %d", draw->y);
+    console_draw_print(0, draw->y, text, 0);
+    draw->status = console_draw_commit();
+    return 0;
+}
+
+/*
+ * More threads than there are draw buffers draw one after the other,
+ * each one gets the buffer of a thread that exited before it
+ */
+static void s_test_draw_threads()
+{
+    console_init_headless(20, 24);
+    console_screen_init(0, 0);
+
+    test_draw draws[24];
+    for(int y = 0; y < 24; ++y)
+    {
+        draws[y].y = y;
+        draws[y].status = -1;
+        pthread_t thread;
+        TEST_CHECK(!pthread_create(&thread, 0, s_test_draw_thread, &draws[y]));
+        pthread_join(thread, 0);
+        TEST_CHECK(draws[y].status == CONSOLE_DRAW_SUCCESS);
+        console_screen_present();
+    }
+
+    for(int y = 0; y < 24; ++y)
+    {
+        char text[16];
+        snprintf(text, sizeof(text), "thread %d", y);
+        TEST_ROW(y, text);
+    }
+
+    console_screen_free();
+    console_cleanup();
+}
+
+/* Fills cells with the characters of text, all with style */
+static void s_test_cells(
+    console_cell *cells,
+    char const *text,
+    console_style const *style
+)
+{
+    for(size_t i = 0; text[i]; ++i)
+    {
+        cells[i].ch = (unsigned char) text[i];
+        cells[i].style = *style;
+    }
+}
+
+/* A clipped blit only writes its cells inside the clip rectangle */
+static void s_test_sprite_clip()
+{
+    static console_style const plain = CONSOLE_STYLE_DEFAULT;
+    static console_style const bold = CONSOLE_STYLE_ATTR(CONSOLE_ATTR_BOLD);
+    static console_style const red = CONSOLE_STYLE_FG(255, 0, 0, 0);
+
+    console_init_headless(20, 6);
+
+    console_cell cells[12];
+    s_test_cells(cells, "ab", &red);
+    s_test_cells(cells + 2, "cd", &bold);
+    s_test_cells(cells + 4, "ef", &red);
+    s_test_cells(cells + 6, "ghijkl", &plain);
+    console_sprite *sprite = console_sprite_create(6, 2, cells);
+    TEST_CHECK(sprite != 0);
+    if(!sprite)
+    {
+        console_cleanup();
+        return;
+    }
+
+    console_sprite_blit(sprite, 2, 1);
+    TEST_ROW(1, "  abcdef");
+    TEST_ROW(2, "  ghijkl");
+    TEST_CHECK(s_test_cell_fg(3, 1, 255, 0, 0));
+    TEST_CHECK(console_headless_cell(4, 1)->style.attr == CONSOLE_ATTR_BOLD);
+    TEST_CHECK(!console_headless_cell(2, 2)->style.attr);
+
+    // Starting in the middle of the bold run still writes d bold
+    console_sprite_blit_clip(sprite, 2, 3, 5, 3, 2, 1);
+    TEST_ROW(3, "     de");
+    TEST_ROW(4, "");
+    TEST_CHECK(console_headless_cell(5, 3)->style.attr == CONSOLE_ATTR_BOLD);
+    TEST_CHECK(s_test_cell_fg(6, 3, 255, 0, 0));
+
+    // Left of and above the terminal
+    console_sprite_blit(sprite, -4, -1);
+    TEST_ROW(0, "kl");
+
+    console_sprite_free(sprite);
+    console_cleanup();
+}
+
+/* A clip through a wide character writes a space for its half */
+static void s_test_sprite_clip_wide()
+{
+    static console_style const plain = CONSOLE_STYLE_DEFAULT;
+
+    console_init_headless(20, 4);
+
+    // "a日本b", each wide character is followed by an empty cell
+    console_cell cells[6];
+    s_test_cells(cells, "a    b", &plain);
+    cells[1].ch = 0x65E5;
+    cells[2].ch = 0;
+    cells[3].ch = 0x672C;
+    cells[4].ch = 0;
+    console_sprite *sprite = console_sprite_create(6, 1, cells);
+    TEST_CHECK(sprite != 0);
+    if(!sprite)
+    {
+        console_cleanup();
+        return;
+    }
+
+    console_sprite_blit(sprite, 0, 0);
+    TEST_ROW(0, "a\xE6\x97\xA5\xE6\x9C\xAC" "b");
+
+    // The clip starts on the right half of 日 and ends on the left
+    // half of 本, both become spaces, and nothing else moves
+    CONSOLE_WRITE_LITERAL("\r\n|||||||");
+    console_sprite_blit_clip(sprite, 0, 1, 2, 1, 2, 1);
+    TEST_ROW(1, "||  |||");
+    TEST_CHECK(console_headless_cell(4, 1)->ch == '|');
+
+    console_sprite_free(sprite);
+    console_cleanup();
+}
+
+/*
+ * A wide character on the last column does not fit, the screen puts a
+ * space instead, and the terminal wraps it to the next row
+ */
+static void s_test_wide_last_column()
+{
+    console_init_headless(10, 4);
+    console_screen_init(0, 0);
+
+    console_screen_print(0, 0, "abcdefghi", 0);
+    console_screen_put(9, 0, 0x65E5, 0); // 日
+    console_screen_print(6, 1, "xy\xE6\x97\xA5", 0);
+    console_screen_present();
+
+    TEST_ROW(0, "abcdefghi");
+    TEST_CHECK(console_headless_cell(9, 0)->ch == ' ');
+    TEST_ROW(1, "      xy\xE6\x97\xA5");
+    TEST_CHECK(console_headless_cell(8, 1)->ch == 0x65E5);
+    TEST_CHECK(console_headless_cell(9, 1)->ch == 0);
+    console_screen_free();
+
+    // Written directly, the terminal wraps it like xterm
+    console_goto(9, 2);
+    CONSOLE_WRITE_LITERAL("\xE6\x97\xA5");
+    console_flush();
+    TEST_CHECK(console_headless_cell(9, 2)->ch == ' ');
+    TEST_CHECK(console_headless_cell(0, 3)->ch == 0x65E5);
+
+    console_cleanup();
+}
+
+/* A log pane shows its last lines, and scrolls back with the keys */
+static void s_test_log_pane()
+{
+    console_init_headless(20, 5);
+    console_screen_init(0, 0);
+
+    console_log *log = console_log_create(0, 1, 20, 3, 4, 64);
+    TEST_CHECK(log != 0);
+    if(!log)
+    {
+        console_cleanup();
+        return;
+    }
+
+    char const text[] = "one\ntwo\nthree\nfour\nfive";
+    console_log_append(log, text, sizeof(text) - 1);
+    console_log_draw(log);
+    console_screen_present();
+    TEST_ROW(1, "three");
+    TEST_ROW(2, "four");
+    TEST_ROW(3, "five");
+
+    // Only 4 lines are kept, "one" was dropped
+    TEST_CHECK(console_log_key(log, CONSOLE_KEY_HOME));
+    console_log_draw(log);
+    console_screen_present();
+    TEST_ROW(1, "two");
+    TEST_ROW(3, "four");
+
+    // A frame that clears the screen draws the pane again
+    console_screen_clear();
+    console_log_draw(log);
+    console_screen_present();
+    TEST_ROW(1, "two");
+    TEST_ROW(3, "four");
+
+    console_log_free(log);
+    console_screen_free();
+    console_cleanup();
+}
+
+/*
+ * Lines keep being appended to a small arena, their text goes around its
+ * end many times and must come back whole
+ */
+static void s_test_log_wrap()
+{
+    console_init_headless(40, 4);
+    console_screen_init(0, 0);
+
+    // About 4 lines fit in the arena, the table could hold more
+    console_log *log = console_log_create(0, 0, 40, 3, 16, 32);
+    TEST_CHECK(log != 0);
+    if(!log)
+    {
+        console_cleanup();
+        return;
+    }
+
+    char text[3][16];
+    for(int n = 0; n < 50; ++n)
+    {
+        snprintf(text[n % 3], sizeof(text[0]), "line %d", n);
+        console_log_append(log, text[n % 3], strlen(text[n % 3]));
+        console_log_draw(log);
+        console_screen_present();
+        if(n >= 2)
+        {
+            TEST_ROW(0, text[(n + 1) % 3]);
+            TEST_ROW(1, text[(n + 2) % 3]);
+            TEST_ROW(2, text[n % 3]);
+        }
+    }
+
+    // The oldest line kept is not older than what fits in the arena
+    TEST_CHECK(console_log_key(log, CONSOLE_KEY_HOME));
+    console_log_draw(log);
+    console_screen_present();
+    char row[64];
+    console_headless_row(0, row, sizeof(row));
+    TEST_CHECK(!strcmp(row, "line 46") || !strcmp(row, "line 47"));
+
+    // A line longer than the arena is cut to what it can hold
+    char const long_line[] = "0123456789012345678901234567890123456789";
+    console_log_key(log, CONSOLE_KEY_END);
+    console_log_append(log, long_line, sizeof(long_line) - 1);
+    console_log_draw(log);
+    console_screen_present();
+    // It is the only line left, at the top of the pane
+    TEST_ROW(0, "0123456789012345678901234567890");
+    TEST_ROW(1, "");
+    TEST_ROW(2, "");
+
+    console_log_free(log);
+    console_screen_free();
+    console_cleanup();
+}
+
+/* console_cleanup resets the style, even if the API thinks it is the default */
+static void s_test_cleanup_reset()
+{
+    console_init_headless(20, 4);
+    console_style_reset();
+    // Written by the program, the API does not know the terminal is bold
+    CONSOLE_WRITE_LITERAL("\e[1m");
+
+    console_stats stats;
+    console_flush();
+    console_stats_reset();
+    console_cleanup();
+    console_stats_get(&stats);
+    TEST_CHECK(!stats.enabled || stats.seq_style == 1);
+}
+
+/* Number of keys set in map */
+static int s_test_keys_down(console_keymap const *map)
+{
+    int count = 0;
+    for(int key = 0; key < CONSOLE_KEY_COUNT; ++key)
+        count += CONSOLE_KEYMAP_TEST(map, key);
+    return count;
+}
+
+/* Bytes a terminal sends for a key, and the key they are decoded as */
+typedef struct
+{
+    char const *bytes;
+    int key;
+} test_tty_key;
+
+/* Keys typed in the terminal are decoded to CONSOLE_KEY_* */
+static void s_test_tty_keys()
+{
+    static test_tty_key const keys[] =
+    {
+        { "a", CONSOLE_KEY_ALNUM(A) },
+        { "Z", CONSOLE_KEY_ALNUM(Z) },
+        { "7", CONSOLE_KEY_ALNUM(7) },
+        { " ", CONSOLE_KEY_SPACE },
+        { "\r", CONSOLE_KEY_ENTER },
+        { "\x7f", CONSOLE_KEY_BACKSPACE },
+        // Tab is the byte of Ctrl+I, it must not be I
+        { "\t", CONSOLE_KEY_TAB },
+        { "\x03", CONSOLE_KEY_ALNUM(C) },
+        { "\e[A", CONSOLE_KEY_UP },
+        { "\eOB", CONSOLE_KEY_DOWN },
+        { "\e[1;5C", CONSOLE_KEY_RIGHT },
+        { "\e[H", CONSOLE_KEY_HOME },
+        { "\e[4~", CONSOLE_KEY_END },
+        { "\e[5~", CONSOLE_KEY_PAGEUP },
+        { "\e[6~", CONSOLE_KEY_PAGEDOWN },
+        // Alone, ESC is only a key once no sequence follows it
+        { "\e", CONSOLE_KEY_ESCAPE },
+    };
+
+    console_init_headless(20, 4);
+
+    console_keymap state;
+    for(size_t i = 0; i < sizeof(keys) / sizeof(*keys); ++i)
+    {
+        console_headless_input(keys[i].bytes, strlen(keys[i].bytes));
+        TEST_CHECK(!console_key_snapshot(&state, 0, 0));
+        if(!CONSOLE_KEYMAP_TEST(&state, keys[i].key)
+           || s_test_keys_down(&state) != 1)
+            printf("  key %zu(\\x%02x...) was not decoded\n",
+                   i, (unsigned char) keys[i].bytes[0]);
+        TEST_CHECK(CONSOLE_KEYMAP_TEST(&state, keys[i].key));
+        TEST_CHECK(s_test_keys_down(&state) == 1);
+
+        // Without releases, the next read lets the key go
+        TEST_CHECK(!console_key_snapshot(&state, 0, 0));
+        TEST_CHECK(!s_test_keys_down(&state));
+    }
+
+    // Replies of the terminal are not keys
+    console_headless_input("\e[?1u", 5);
+    TEST_CHECK(!console_key_snapshot(&state, 0, 0));
+    TEST_CHECK(!s_test_keys_down(&state));
+
+    console_cleanup();
+}
+
+/* Steps of s_test_line_editor, run as the line editor reads keys */
+static void s_test_line_editor_input(void *ctx)
+{
+    int *step = ctx;
+    int x, y;
+    switch((*step)++)
+    {
+        case 0:
+            // Each wide character takes two cells
+            console_headless_input("\xE6\x97\xA5\xE6\x9C\xAC" "a", 7);
+            break;
+        case 1:
+            console_headless_cursor(&x, &y);
+            TEST_CHECK(x == 7 && y == 1);
+            console_headless_input("\e[D\e[D", 6);
+            break;
+        case 2:
+            console_headless_cursor(&x, &y);
+            TEST_CHECK(x == 4 && y == 1);
+            // Typing in the middle of the line moves what is after
+            console_headless_input("\xC3\xA9", 2);
+            break;
+        case 3:
+            console_headless_cursor(&x, &y);
+            TEST_CHECK(x == 5 && y == 1);
+            TEST_ROW(1, "> \xE6\x97\xA5\xC3\xA9\xE6\x9C\xAC" "a");
+            console_headless_input("\r", 1);
+            break;
+    }
+}
+
+/* The cursor follows the cells of what was typed, not its bytes */
+static void s_test_line_editor()
+{
+    console_init_headless(20, 4);
+    CONSOLE_WRITE_LITERAL("\r\n> ");
+
+    int step = 0;
+    console_headless_on_input(s_test_line_editor_input, &step);
+    char line[64];
+    TEST_CHECK(console_fgets(line, sizeof(line)) != 0);
+    TEST_CHECK(step == 4);
+    TEST_CHECK(!strcmp(line, "\xE6\x97\xA5\xC3\xA9\xE6\x9C\xAC" "a"));
+
+    console_headless_on_input(0, 0);
+    console_cleanup();
+}
+
+/* Lines of s_test_line_history, one per call of console_fgets */
+static void s_test_line_history_input(void *ctx)
+{
+    int *step = ctx;
+    switch((*step)++)
+    {
+        case 0:
+            console_headless_input("\xE6\x97\xA5\xE6\x9C\xAC" "ab\r", 9);
+            break;
+        case 1:
+            console_headless_input("\e[A\r", 4);
+            break;
+    }
+}
+
+/* A line from the history that does not fit is cut between characters */
+static void s_test_line_history()
+{
+    console_init_headless(20, 4);
+
+    int step = 0;
+    console_headless_on_input(s_test_line_history_input, &step);
+    char line[64];
+    TEST_CHECK(console_fgets(line, sizeof(line)) != 0);
+    TEST_CHECK(!strcmp(line, "\xE6\x97\xA5\xE6\x9C\xAC" "ab"));
+
+    // 5 bytes would end in the middle of 本
+    TEST_CHECK(console_fgets(line, 6) != 0);
+    TEST_CHECK(!strcmp(line, "\xE6\x97\xA5"));
+
+    console_headless_on_input(0, 0);
+    console_cleanup();
+}
+
+/* Keys typed in the menu, all at once like fast typing would */
+static void s_test_menu_filter_input(void *ctx)
+{
+    int *step = ctx;
+    if((*step)++)
+        return;
+    // Typos are fixed with backspace, then DOWN goes to the second match
+    char const keys[] = "DB-01.px\x7f" "\e[B\r";
+    console_headless_input(keys, sizeof(keys) - 1);
+}
+
+/* Any printable character filters the menu, none of them is lost */
+static void s_test_menu_filter()
+{
+    console_init_headless(40, 10);
+
+    menu_ent entries[] =
+    {
+        { "web/01", 1, "frontend", 0 },
+        { "db-01.stage", 2, "staging", 0 },
+        { "db-01.prod", 3, "primary", 0 },
+        { "db-01.prod2", 4, "replica", 0 },
+    };
+    int step = 0;
+    console_headless_on_input(s_test_menu_filter_input, &step);
+    size_t picked = console_menu("Host", entries, 4);
+    TEST_CHECK(picked == 4);
+
+    console_headless_on_input(0, 0);
+    console_cleanup();
+}
+
+typedef struct
+{
+    char const *name;
+    void (*run)();
+} test;
+
+static test const s_tests[] =
+{
+    { "screen_present", s_test_screen_present },
+    { "stats", s_test_stats },
+    { "frame_pacing", s_test_frame_pacing },
+    { "color_depth", s_test_color_depth },
+    { "cursor_moves", s_test_cursor_moves },
+    { "screen_scroll", s_test_screen_scroll },
+    { "screen_scroll_narrow", s_test_screen_scroll_narrow },
+    { "draw_threads", s_test_draw_threads },
+    { "sprite_clip", s_test_sprite_clip },
+    { "sprite_clip_wide", s_test_sprite_clip_wide },
+    { "wide_last_column", s_test_wide_last_column },
+    { "log_pane", s_test_log_pane },
+    { "log_wrap", s_test_log_wrap },
+    { "cleanup_reset", s_test_cleanup_reset },
+    { "tty_keys", s_test_tty_keys },
+    { "line_editor", s_test_line_editor },
+    { "line_history", s_test_line_history },
+    { "menu_filter", s_test_menu_filter },
+};
+
+int main(int argc, char **argv)
+{
+    char const *filter = argc > 1 ? argv[1] : 0;
+    int failed = 0;
+
+    for(size_t i = 0; i < sizeof(s_tests) / sizeof(*s_tests); ++i)
+    {
+        test const *t = &s_tests[i];
+        if(filter && !strstr(t->name, filter))
+            continue;
+
+        s_test_failed = 0;
+        t->run();
+        printf("%-24s %s\n", t->name, s_test_failed ? "FAILED" : "ok");
+        failed += s_test_failed != 0;
+    }
+
+    return failed != 0;
+}